@@ -0,0 +1,639 @@
+/*
+ * bench.c - Headless benchmarks for the tempus database paths
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#define _XOPEN_SOURCE	700		/* mkdtemp(3), localtime_r(3) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <linux/limits.h>
+
+#include <sqlite3.h>
+
+#include <tcutil.h>
+#include <tctdb.h>
+
+#include "short_types.h"
+#include "db.h"
+#include "schema.h"
+#include "convert_db.h"
+#include "util.h"
+#include "stats.h"
+#include "date.h"
+
+/*
+ * Roughly what a busy user accumulates: a handful of entries a day
+ * spread over a few tens of entities, each with a few projects, each
+ * with a few sub projects.
+ */
+#define ENTRIES_PER_DAY		8
+#define NR_ENTITIES		20
+#define PROJECTS_PER_ENTITY	10
+#define SUBS_PER_PROJECT	10
+
+#define HISTORY_DAYS		180
+/* Rows per page of the history, as the GUI reads it */
+#define HISTORY_PAGE		500
+#define NR_SAVES		1000
+
+/* Keeps the column reads in drain_stmt() from being optimised away */
+static volatile size_t column_bytes;
+
+static const u32 default_sizes[] = { 10000, 100000, 1000000 };
+
+static const char *words[] = {
+	"meeting", "review", "design", "fix", "build", "deploy", "call",
+	"email", "planning", "testing", "docs", "support", "refactor",
+	"release", "research", "the", "for", "and", "with", "customer"
+};
+
+struct entry {
+	char date[11];
+	char entity[32];
+	char project[32];
+	char sub_project[32];
+	char description[256];
+	int duration;
+};
+
+struct gen {
+	u64 state;
+	u32 rows;
+	u32 row;
+	time_t start;
+	int day;
+	char date[11];
+};
+
+static void disp_usage(void)
+{
+	printf("Usage: bench [-n rows]... [-d dir] [-c] [-k]\n\n");
+	printf("  -n  Number of rows to generate, may be repeated "
+	       "(default 10000, 100000 & 1000000)\n");
+	printf("  -d  Directory to create the databases in (default "
+	       "$TMPDIR or /tmp)\n");
+	printf("  -c  Also time the tokyocabinet conversion\n");
+	printf("  -k  Keep the generated databases\n");
+}
+
+/* xorshift64*, so runs are reproducible */
+static u32 rnd(struct gen *g)
+{
+	g->state ^= g->state >> 12;
+	g->state ^= g->state << 25;
+	g->state ^= g->state >> 27;
+
+	return (g->state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static void gen_init(struct gen *g, u32 rows)
+{
+	g->state = 0x9E3779B97F4A7C15ULL;
+	g->rows = rows;
+	g->row = 0;
+	g->start = time(NULL) - (time_t)(rows / ENTRIES_PER_DAY) * 86400;
+	g->day = -1;
+}
+
+/*
+ * Entries are generated in date order finishing today, with the
+ * entities skewed so a few of them account for most of the time.
+ */
+static void gen_entry(struct gen *g, struct entry *e)
+{
+	int day = g->row / ENTRIES_PER_DAY;
+	u32 entity;
+	u32 project;
+	u32 sub_project;
+	u32 nr_words;
+	size_t len = 0;
+
+	if (day != g->day) {
+		time_t t = g->start + (time_t)day * 86400;
+		struct tm tm;
+
+		localtime_r(&t, &tm);
+		strftime(g->date, sizeof(g->date), "%F", &tm);
+		g->day = day;
+	}
+	g->row++;
+
+	entity = (rnd(g) % NR_ENTITIES) * (rnd(g) % NR_ENTITIES) /
+		 NR_ENTITIES;
+	project = entity * PROJECTS_PER_ENTITY + rnd(g) % PROJECTS_PER_ENTITY;
+	sub_project = project * SUBS_PER_PROJECT + rnd(g) % SUBS_PER_PROJECT;
+
+	memcpy(e->date, g->date, sizeof(e->date));
+	snprintf(e->entity, sizeof(e->entity), "Entity %02u", entity);
+	snprintf(e->project, sizeof(e->project), "Project %03u", project);
+	snprintf(e->sub_project, sizeof(e->sub_project), "Sub-project %04u",
+		 sub_project);
+	e->duration = 300 + rnd(g) % (4 * 3600);
+
+	e->description[0] = '\0';
+	nr_words = rnd(g) % 24;
+	while (nr_words--) {
+		const char *word = words[rnd(g) % G_N_ELEMENTS(words)];
+
+		len += snprintf(e->description + len,
+				sizeof(e->description) - len, "%s%s",
+				len ? " " : "", word);
+		if (len >= sizeof(e->description))
+			break;
+	}
+}
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static long peak_rss_kib(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return ru.ru_maxrss;
+}
+
+static void report(u32 rows, const char *phase, u32 ops, double us)
+{
+	printf("%8u  %-16s %8u %12.1f %12.1f %10ld\n", rows, phase, ops,
+	       us / 1e3, ops ? us / ops : 0.0, peak_rss_kib());
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report_percentiles(u32 rows, const char *phase, double *lat,
+			       u32 nr)
+{
+	qsort(lat, nr, sizeof(double), cmp_double);
+	printf("%8u  %-16s %8s %12s p50 %.1fus p99 %.1fus max %.1fus\n",
+	       rows, phase, "", "", lat[nr / 2], lat[nr * 99 / 100],
+	       lat[nr - 1]);
+}
+
+static int gen_tdb(const char *path, u32 rows)
+{
+	struct gen g;
+	TCTDB *tdb;
+	u32 i;
+	int ret = -1;
+
+	tdb = tctdbnew();
+	if (!tctdbopen(tdb, path, TDBOWRITER | TDBOCREAT | TDBOTRUNC)) {
+		fprintf(stderr, "tctdbopen: %s\n",
+			tctdberrmsg(tctdbecode(tdb)));
+		goto out_del;
+	}
+
+	gen_init(&g, rows);
+	for (i = 0; i < rows; i++) {
+		struct entry e;
+		char pkbuf[32];
+		char hours[16];
+		TCMAP *cols;
+		int pksiz;
+		u32 h;
+		u32 m;
+		u32 s;
+
+		gen_entry(&g, &e);
+		seconds_to_hms(e.duration, &h, &m, &s);
+		snprintf(hours, sizeof(hours), "%02u:%02u:%02u", h, m, s);
+
+		cols = tcmapnew();
+		tcmapput2(cols, "date", e.date);
+		tcmapput2(cols, "company", e.entity);
+		tcmapput2(cols, "project", e.project);
+		tcmapput2(cols, "sub_project", e.sub_project);
+		tcmapput2(cols, "hours", hours);
+		tcmapput2(cols, "description", e.description);
+
+		pksiz = snprintf(pkbuf, sizeof(pkbuf), "%lld",
+				 (long long)tctdbgenuid(tdb));
+		tctdbput(tdb, pkbuf, pksiz, cols);
+		tcmapdel(cols);
+	}
+	ret = 0;
+
+	tctdbclose(tdb);
+out_del:
+	tctdbdel(tdb);
+
+	return ret;
+}
+
+/*
+ * Populate a fresh tempus.sqlite in a single transaction. The schema
+ * (and thus the summary triggers) is in place beforehand, so this also
+ * measures the cost of trigger maintenance on bulk inserts.
+ */
+static int gen_sqlite(const char *path, u32 rows)
+{
+	struct gen g;
+	sqlite3 *db;
+	sqlite3_stmt *names_stmt;
+	sqlite3_stmt *stmt;
+	u32 i;
+	int ret = -1;
+
+	if (sqlite3_open(path, &db) != SQLITE_OK) {
+		fprintf(stderr, "Can't open database: %s\n",
+			sqlite3_errmsg(db));
+		goto out_close;
+	}
+	if (schema_migrate(db) == -1)
+		goto out_close;
+	if (sqlite3_prepare_v2(db, SQL_ADD_NAMES, -1, &names_stmt,
+			       NULL) != SQLITE_OK) {
+		fprintf(stderr, "sqlite prepare failed: %s\n",
+			sqlite3_errmsg(db));
+		goto out_close;
+	}
+	if (sqlite3_prepare_v2(db, SQL_INSERT, -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "sqlite prepare failed: %s\n",
+			sqlite3_errmsg(db));
+		sqlite3_finalize(names_stmt);
+		goto out_close;
+	}
+
+	sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+	gen_init(&g, rows);
+	for (i = 0; i < rows; i++) {
+		struct entry e;
+
+		gen_entry(&g, &e);
+		sqlite3_bind_text(names_stmt, 1, e.entity, -1, SQLITE_STATIC);
+		sqlite3_bind_text(names_stmt, 2, e.project, -1, SQLITE_STATIC);
+		sqlite3_bind_text(names_stmt, 3, e.sub_project, -1,
+				  SQLITE_STATIC);
+		sqlite3_step(names_stmt);
+		sqlite3_reset(names_stmt);
+
+		sqlite3_bind_text(stmt, 1, e.date, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 2, e.entity, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 3, e.project, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 4, e.sub_project, -1, SQLITE_STATIC);
+		sqlite3_bind_int(stmt, 5, e.duration);
+		sqlite3_bind_text(stmt, 6, e.description, -1, SQLITE_STATIC);
+		if (sqlite3_step(stmt) != SQLITE_DONE) {
+			fprintf(stderr, "sqlite execution failed: %s\n",
+				sqlite3_errmsg(db));
+			sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+			goto out_finalize;
+		}
+		sqlite3_reset(stmt);
+	}
+	sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+	ret = 0;
+
+out_finalize:
+	sqlite3_finalize(stmt);
+	sqlite3_finalize(names_stmt);
+out_close:
+	sqlite3_close(db);
+
+	return ret;
+}
+
+/* Step through a statement touching each column as the GUI would */
+static u32 drain_stmt(sqlite3_stmt *stmt)
+{
+	u32 nr = 0;
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		int i;
+
+		for (i = 0; i < sqlite3_column_count(stmt); i++)
+			column_bytes += sqlite3_column_bytes(stmt, i);
+		nr++;
+	}
+	sqlite3_reset(stmt);
+
+	return nr;
+}
+
+/*
+ * Read the history from day from back a page at a time, as the GUI does,
+ * stopping after max_pages (0 for all of them).
+ */
+static u32 drain_history(int from, u32 max_pages)
+{
+	sqlite3_stmt *stmt = db_stmt(DB_STMT_HISTORY);
+	int before_day = DATE_MAX;
+	sqlite3_int64 before_id = INT64_MAX;
+	u32 pages = 0;
+	u32 nr = 0;
+	u32 page_nr;
+
+	do {
+		sqlite3_bind_int(stmt, 1, from);
+		sqlite3_bind_int(stmt, 2, before_day);
+		sqlite3_bind_int64(stmt, 3, before_id);
+		sqlite3_bind_int(stmt, 4, HISTORY_PAGE);
+
+		page_nr = 0;
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			int i;
+
+			for (i = 0; i < sqlite3_column_count(stmt); i++)
+				column_bytes += sqlite3_column_bytes(stmt, i);
+			before_day = sqlite3_column_int(stmt, SQL_COL_DAY);
+			before_id = sqlite3_column_int64(stmt, SQL_COL_ID);
+			page_nr++;
+		}
+		sqlite3_reset(stmt);
+
+		nr += page_nr;
+		pages++;
+	} while (page_nr == HISTORY_PAGE && pages != max_pages);
+
+	return nr;
+}
+
+static void bench_history(u32 rows)
+{
+	double start;
+	u32 nr;
+
+	start = now_us();
+	nr = drain_history(DATE_NONE, 1);
+	report(rows, "load (page)", nr, now_us() - start);
+
+	start = now_us();
+	nr = drain_history(date_today() - HISTORY_DAYS, 0);
+	report(rows, "load (180 days)", nr, now_us() - start);
+
+	start = now_us();
+	nr = drain_history(DATE_NONE, 0);
+	report(rows, "load (all)", nr, now_us() - start);
+}
+
+static void bench_summaries(u32 rows)
+{
+	sqlite3_stmt *stmt;
+	double start;
+	u32 nr;
+
+	start = now_us();
+	stmt = db_stmt(DB_STMT_SUMMARIES);
+	nr = drain_stmt(stmt);
+	report(rows, "summary totals", nr, now_us() - start);
+
+	start = now_us();
+	stmt = db_stmt(DB_STMT_RANGE_TOTALS);
+	sqlite3_bind_text(stmt, 1, "0000-00-00", -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, "9999-12-31", -1, SQLITE_STATIC);
+	nr = drain_stmt(stmt);
+	report(rows, "summary range", nr, now_us() - start);
+
+	start = now_us();
+	stmt = db_stmt(DB_STMT_ROLLUPS);
+	sqlite3_bind_int(stmt, 1, ROLLUP_WEEK);
+	sqlite3_bind_text(stmt, 2, "0000-00-00", -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 3, "9999-12-31", -1, SQLITE_STATIC);
+	nr = drain_stmt(stmt);
+	report(rows, "summary weekly", nr, now_us() - start);
+
+	start = now_us();
+	stmt = db_stmt(DB_STMT_ROLLUPS);
+	sqlite3_bind_int(stmt, 1, ROLLUP_MONTH);
+	sqlite3_bind_text(stmt, 2, "0000-00-00", -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 3, "9999-12-31", -1, SQLITE_STATIC);
+	nr = drain_stmt(stmt);
+	report(rows, "summary monthly", nr, now_us() - start);
+}
+
+/* As the GUI saves an entry, id is -1 for a new one */
+static sqlite3_int64 save_entry(const struct entry *e, sqlite3_int64 id)
+{
+	sqlite3_stmt *stmt;
+
+	sqlite3_exec(db_get(), "BEGIN", NULL, NULL, NULL);
+
+	stmt = db_stmt(DB_STMT_ADD_NAMES);
+	sqlite3_bind_text(stmt, 1, e->entity, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, e->project, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 3, e->sub_project, -1, SQLITE_STATIC);
+	sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+
+	stmt = db_stmt(id == -1 ? DB_STMT_INSERT : DB_STMT_UPDATE);
+	sqlite3_bind_text(stmt, 1, e->date, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, e->entity, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 3, e->project, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 4, e->sub_project, -1, SQLITE_STATIC);
+	sqlite3_bind_int(stmt, 5, e->duration);
+	sqlite3_bind_text(stmt, 6, e->description, -1, SQLITE_STATIC);
+	if (id != -1)
+		sqlite3_bind_int64(stmt, 7, id);
+	sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+
+	sqlite3_exec(db_get(), "COMMIT", NULL, NULL, NULL);
+
+	return id == -1 ? sqlite3_last_insert_rowid(db_get()) : id;
+}
+
+/*
+ * Each save is its own transaction, as it is from the GUI, first as a
+ * new entry then as an edit of it.
+ */
+static void bench_save(u32 rows)
+{
+	struct gen g;
+	double lat[NR_SAVES];
+	sqlite3_int64 ids[NR_SAVES];
+	double total = 0.0;
+	u32 i;
+
+	gen_init(&g, rows);
+	g.state ^= rows;
+	for (i = 0; i < NR_SAVES; i++) {
+		struct entry e;
+		double start;
+
+		gen_entry(&g, &e);
+		start = now_us();
+		ids[i] = save_entry(&e, -1);
+		lat[i] = now_us() - start;
+		total += lat[i];
+	}
+	report(rows, "save (new)", NR_SAVES, total);
+	report_percentiles(rows, "save (new)", lat, NR_SAVES);
+
+	total = 0.0;
+	for (i = 0; i < NR_SAVES; i++) {
+		struct entry e;
+		double start;
+
+		gen_entry(&g, &e);
+		start = now_us();
+		save_entry(&e, ids[i]);
+		lat[i] = now_us() - start;
+		total += lat[i];
+	}
+	report(rows, "save (edit)", NR_SAVES, total);
+	report_percentiles(rows, "save (edit)", lat, NR_SAVES);
+}
+
+static int bench_convert(const char *dir, u32 rows)
+{
+	char path[PATH_MAX];
+	double start;
+	int err;
+
+	snprintf(path, sizeof(path), "%s/tempus.tdb", dir);
+	start = now_us();
+	err = gen_tdb(path, rows);
+	if (err)
+		return err;
+	report(rows, "generate (tdb)", rows, now_us() - start);
+
+	start = now_us();
+	err = convert_db(path);
+	if (err)
+		return err;
+	report(rows, "convert", rows, now_us() - start);
+
+	snprintf(path, sizeof(path), "%s/tempus.sqlite", dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/tempus.tdb.bak", dir);
+	unlink(path);
+
+	return 0;
+}
+
+static int bench(const char *tmpdir, u32 rows, bool convert, bool keep)
+{
+	char dir[PATH_MAX];
+	char path[PATH_MAX];
+	double start;
+	int ret = -1;
+
+	snprintf(dir, sizeof(dir), "%s/tempus-bench-XXXXXX", tmpdir);
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return -1;
+	}
+
+	if (convert && bench_convert(dir, rows) == -1)
+		goto out_rmdir;
+
+	snprintf(path, sizeof(path), "%s/tempus.sqlite", dir);
+	start = now_us();
+	if (gen_sqlite(path, rows) == -1)
+		goto out_unlink;
+	report(rows, "generate", rows, now_us() - start);
+
+	start = now_us();
+	if (db_open(path, false) == -1)
+		goto out_unlink;
+	report(rows, "open", 1, now_us() - start);
+
+	bench_history(rows);
+	bench_summaries(rows);
+	bench_save(rows);
+
+	db_close();
+	ret = 0;
+
+out_unlink:
+	if (keep) {
+		printf("%8u  kept %s\n", rows, path);
+		return ret;
+	}
+	unlink(path);
+out_rmdir:
+	rmdir(dir);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *tmpdir = getenv("TMPDIR");
+	u32 sizes[16];
+	int nr_sizes = 0;
+	bool convert = false;
+	bool keep = false;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "n:d:ckh")) != -1) {
+		switch (opt) {
+		case 'n':
+			if (nr_sizes == G_N_ELEMENTS(sizes)) {
+				fprintf(stderr, "Too many sizes\n");
+				exit(EXIT_FAILURE);
+			}
+			sizes[nr_sizes] = strtoul(optarg, NULL, 10);
+			if (sizes[nr_sizes] == 0) {
+				disp_usage();
+				exit(EXIT_FAILURE);
+			}
+			nr_sizes++;
+			break;
+		case 'd':
+			tmpdir = optarg;
+			break;
+		case 'c':
+			convert = true;
+			break;
+		case 'k':
+			keep = true;
+			break;
+		case 'h':
+			disp_usage();
+			exit(EXIT_SUCCESS);
+		default:
+			disp_usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* TEMPUS_STATS breaks the runs down further */
+	stats_init(false);
+
+	if (!tmpdir)
+		tmpdir = "/tmp";
+	if (!nr_sizes) {
+		memcpy(sizes, default_sizes, sizeof(default_sizes));
+		nr_sizes = G_N_ELEMENTS(default_sizes);
+	}
+
+	printf("%8s  %-16s %8s %12s %12s %10s\n", "rows", "phase", "ops",
+	       "total ms", "per-op us", "peak KiB");
+	for (i = 0; i < nr_sizes; i++) {
+		if (bench(tmpdir, sizes[i], convert, keep) == -1)
+			exit(EXIT_FAILURE);
+	}
+
+	stats_report(stderr);
+
+	exit(EXIT_SUCCESS);
+}
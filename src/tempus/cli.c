@@ -0,0 +1,453 @@
+/*
+ * cli.c - Headless command line interface
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <sqlite3.h>
+
+#include <glib.h>
+
+#include "db.h"
+#include "schema.h"
+#include "util.h"
+#include "stats.h"
+#include "cli.h"
+#include "date.h"
+#include "export.h"
+
+struct cli_opts {
+	const char *from;
+	const char *to;
+	const char *entity;
+	const char *project;
+	const char *sub_project;
+	int period;		/* < 0 for overall totals */
+	int format;		/* enum export_format */
+	bool seconds;
+
+	char **args;		/* Whatever follows the options */
+};
+
+struct cli_cmd {
+	const char *name;
+	const char *usage;
+	int (*func)(sqlite3 *db, const struct cli_opts *opts);
+};
+
+static const struct option cli_long_opts[] = {
+	{ "from",	 required_argument, NULL, 'f' },
+	{ "since",	 required_argument, NULL, 'f' },
+	{ "to",		 required_argument, NULL, 't' },
+	{ "until",	 required_argument, NULL, 't' },
+	{ "period",	 required_argument, NULL, 'p' },
+	{ "entity",	 required_argument, NULL, 'e' },
+	{ "project",	 required_argument, NULL, 'P' },
+	{ "sub-project", required_argument, NULL, 'S' },
+	{ "format",	 required_argument, NULL, 'F' },
+	{ "seconds",	 no_argument,	    NULL, 's' },
+	{ "help",	 no_argument,	    NULL, 'h' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/*
+ * Write a tab separated field, escaping anything that would break the
+ * one record per line format.
+ */
+static void put_field(const char *str, bool last)
+{
+	for (; str && *str; str++) {
+		switch (*str) {
+		case '\t':
+			fputs("\\t", stdout);
+			break;
+		case '\n':
+			fputs("\\n", stdout);
+			break;
+		case '\\':
+			fputs("\\\\", stdout);
+			break;
+		default:
+			putchar(*str);
+		}
+	}
+	putchar(last ? '\n' : '\t');
+}
+
+/* A row of SQL_HISTORY (or anything with the same columns) */
+static void put_entry(sqlite3_stmt *stmt)
+{
+	char dur[16];
+
+	secs_to_dur(sqlite3_column_int(stmt, SQL_COL_DURATION), dur,
+		    sizeof(dur), NULL);
+
+	put_field((char *)sqlite3_column_text(stmt, SQL_COL_DATE), false);
+	put_field((char *)sqlite3_column_text(stmt, SQL_COL_ENTITY), false);
+	put_field((char *)sqlite3_column_text(stmt, SQL_COL_PROJECT), false);
+	put_field((char *)sqlite3_column_text(stmt, SQL_COL_SUB_PROJECT),
+		  false);
+	put_field(dur, false);
+	put_field((char *)sqlite3_column_text(stmt, SQL_COL_DESCRIPTION),
+		  true);
+}
+
+static int check_step(sqlite3 *db, int rc)
+{
+	if (rc == SQLITE_DONE)
+		return 0;
+
+	fprintf(stderr, "sqlite execution failed: %s\n", sqlite3_errmsg(db));
+
+	return -1;
+}
+
+static sqlite3_stmt *prepare(sqlite3 *db, const char *sql)
+{
+	sqlite3_stmt *stmt;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "sqlite prepare failed: %s\n",
+			sqlite3_errmsg(db));
+		return NULL;
+	}
+
+	return stmt;
+}
+
+static int cmd_list(sqlite3 *db, const struct cli_opts *opts)
+{
+	sqlite3_stmt *stmt = prepare(db, SQL_HISTORY);
+	int rc;
+
+	if (!stmt)
+		return -1;
+
+	sqlite3_bind_int(stmt, 1, opts->from ? date_to_day(opts->from) :
+					       DATE_NONE);
+	sqlite3_bind_int(stmt, 2, opts->to ? date_to_day(opts->to) : DATE_MAX);
+	/* All of it in one go, rather than a page at a time */
+	sqlite3_bind_int64(stmt, 3, G_MAXINT64);
+	sqlite3_bind_int(stmt, 4, -1);
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+		put_entry(stmt);
+	sqlite3_finalize(stmt);
+
+	return check_step(db, rc);
+}
+
+/*
+ * The search terms are the rest of the command line, the same as would
+ * be typed into the search window.
+ */
+static int cmd_search(sqlite3 *db, const struct cli_opts *opts)
+{
+	sqlite3_stmt *stmt;
+	char *terms = g_strjoinv(" ", opts->args);
+	char *query = db_fts_query(terms);
+	int rc;
+
+	g_free(terms);
+	if (!query) {
+		fprintf(stderr, "Nothing to search for\n");
+		return -1;
+	}
+
+	stmt = prepare(db, SQL_SEARCH);
+	if (!stmt) {
+		g_free(query);
+		return -1;
+	}
+
+	sqlite3_bind_text(stmt, 1, query, -1, NULL);
+	sqlite3_bind_int(stmt, 2, opts->from ? date_to_day(opts->from) :
+					       DATE_NONE);
+	sqlite3_bind_int(stmt, 3, opts->to ? date_to_day(opts->to) : DATE_MAX);
+	sqlite3_bind_int(stmt, 4, -1);	/* No limit */
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+		put_entry(stmt);
+	sqlite3_finalize(stmt);
+	g_free(query);
+
+	return check_step(db, rc);
+}
+
+/*
+ * Same output as the summaries window. All these queries return the
+ * same columns as SQL_SUMMARIES.
+ */
+static int cmd_report(sqlite3 *db, const struct cli_opts *opts)
+{
+	sqlite3_stmt *stmt;
+	const char *from = opts->from ? opts->from : "";
+	const char *to = opts->to ? opts->to : "9999-12-31";
+	int col = 1;
+	int rc;
+
+	if (opts->period < 0 && !opts->from && !opts->to)
+		stmt = prepare(db, SQL_SUMMARIES);
+	else if (opts->period < 0)
+		stmt = prepare(db, SQL_RANGE_TOTALS);
+	else
+		stmt = prepare(db, SQL_ROLLUPS);
+	if (!stmt)
+		return -1;
+
+	if (opts->period >= 0)
+		sqlite3_bind_int(stmt, col++, opts->period);
+	if (opts->period >= 0 || opts->from || opts->to) {
+		sqlite3_bind_text(stmt, col++, from, -1, NULL);
+		sqlite3_bind_text(stmt, col++, to, -1, NULL);
+	}
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		const char *start = (char *)sqlite3_column_text(stmt, 0);
+		const char *end = (char *)sqlite3_column_text(stmt, 1);
+		char dur[16];
+
+		if (!start)
+			continue;
+
+		if (strcmp(start, end) == 0)
+			printf("%s\t", start);
+		else
+			printf("%s -- %s\t", start, end);
+		put_field((char *)sqlite3_column_text(stmt, 2), false);
+		put_field((char *)sqlite3_column_text(stmt, 3), false);
+		put_field((char *)sqlite3_column_text(stmt, 4), false);
+		put_field(secs_to_dur(sqlite3_column_int(stmt, 5), dur,
+				      sizeof(dur), "%u:%02u:%02u"), true);
+	}
+	sqlite3_finalize(stmt);
+
+	return check_step(db, rc);
+}
+
+static int cmd_total(sqlite3 *db, const struct cli_opts *opts)
+{
+	sqlite3_stmt *stmt;
+	sqlite3_int64 total = 0;
+	bool range = opts->from || opts->to;
+	int rc;
+
+	stmt = prepare(db, range ? SQL_RANGE_TOTAL : SQL_TOTAL);
+	if (!stmt)
+		return -1;
+
+	/* Unbound parameters are NULL, i.e match anything */
+	if (opts->entity)
+		sqlite3_bind_text(stmt, 1, opts->entity, -1, NULL);
+	if (opts->project)
+		sqlite3_bind_text(stmt, 2, opts->project, -1, NULL);
+	if (opts->sub_project)
+		sqlite3_bind_text(stmt, 3, opts->sub_project, -1, NULL);
+	if (range) {
+		sqlite3_bind_text(stmt, 4, opts->from ? opts->from : "", -1,
+				  NULL);
+		sqlite3_bind_text(stmt, 5, opts->to ? opts->to : "9999-12-31",
+				  -1, NULL);
+	}
+
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW) {
+		total = sqlite3_column_int64(stmt, 0);
+		rc = sqlite3_step(stmt);
+	}
+	sqlite3_finalize(stmt);
+
+	if (check_step(db, rc) != 0)
+		return -1;
+
+	if (opts->seconds) {
+		printf("%lld\n", (long long)total);
+	} else {
+		char dur[24];
+
+		printf("%s\n", secs_to_dur(total, dur, sizeof(dur),
+					   "%u:%02u:%02u"));
+	}
+
+	return 0;
+}
+
+/* Streamed to stdout, so it can be piped straight into something else */
+static int cmd_export(sqlite3 *db, const struct cli_opts *opts)
+{
+	sqlite3_stmt *stmt = prepare(db, SQL_EXPORT);
+	struct export_filter filter = {
+		.from = opts->from ? date_to_day(opts->from) : DATE_NONE,
+		.to = opts->to ? date_to_day(opts->to) : DATE_MAX,
+		.entity = opts->entity,
+		.project = opts->project,
+		.sub_project = opts->sub_project,
+	};
+	s64 nr_rows;
+
+	if (!stmt)
+		return -1;
+
+	nr_rows = export_entries(stmt, &filter, opts->format, stdout);
+	sqlite3_finalize(stmt);
+
+	return nr_rows < 0 ? -1 : 0;
+}
+
+static const struct cli_cmd cli_cmds[] = {
+	{ "list",	"[--since YYYY-MM-DD] [--until YYYY-MM-DD]",
+	  cmd_list },
+	{ "report",	"[--period day|week|month] "
+			"[--from YYYY-MM-DD] [--to YYYY-MM-DD]",
+	  cmd_report },
+	{ "total",	"[--entity NAME] [--project NAME] "
+			"[--sub-project NAME]\n\t\t"
+			"[--from YYYY-MM-DD] [--to YYYY-MM-DD] [--seconds]",
+	  cmd_total },
+	{ "search",	"[--from YYYY-MM-DD] [--to YYYY-MM-DD] "
+			"WORD|\"PHRASE\"...",
+	  cmd_search },
+	{ "export",	"[--format csv|jsonl|ical] [--entity NAME] "
+			"[--project NAME]\n\t\t[--sub-project NAME] "
+			"[--from YYYY-MM-DD] [--to YYYY-MM-DD]",
+	  cmd_export },
+	{ NULL, NULL, NULL }
+};
+
+static const struct cli_cmd *get_cmd(const char *name)
+{
+	const struct cli_cmd *cmd;
+
+	for (cmd = cli_cmds; cmd->name; cmd++) {
+		if (strcmp(cmd->name, name) == 0)
+			return cmd;
+	}
+
+	return NULL;
+}
+
+static void disp_cmd_usage(const struct cli_cmd *cmd)
+{
+	fprintf(stderr, "Usage: tempus %s %s\n", cmd->name, cmd->usage);
+}
+
+static int parse_period(const char *period)
+{
+	if (strcmp(period, "day") == 0)
+		return ROLLUP_DAY;
+	else if (strcmp(period, "week") == 0)
+		return ROLLUP_WEEK;
+	else if (strcmp(period, "month") == 0)
+		return ROLLUP_MONTH;
+
+	return -2;
+}
+
+bool cli_is_command(const char *name)
+{
+	return get_cmd(name) != NULL;
+}
+
+/*
+ * Run one of the command line sub-commands. argv[0] is the command name.
+ *
+ * The database is only opened read-only and GTK is never initialised,
+ * so these are suitable for use from scripts and cron etc.
+ */
+int cli_main(const char *db_path, int argc, char **argv)
+{
+	const struct cli_cmd *cmd = get_cmd(argv[0]);
+	struct cli_opts opts = { .period = -1, .format = EXPORT_CSV };
+	sqlite3 *db;
+	int opt;
+	int rc;
+	int ret = EXIT_FAILURE;
+
+	while ((opt = getopt_long(argc, argv, "f:t:p:e:P:S:F:sh", cli_long_opts,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'f':
+		case 't':
+			if (!is_valid_date(optarg)) {
+				disp_cmd_usage(cmd);
+				return EXIT_FAILURE;
+			}
+			if (opt == 'f')
+				opts.from = optarg;
+			else
+				opts.to = optarg;
+			break;
+		case 'p':
+			opts.period = parse_period(optarg);
+			if (opts.period < 0) {
+				disp_cmd_usage(cmd);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'e':
+			opts.entity = optarg;
+			break;
+		case 'P':
+			opts.project = optarg;
+			break;
+		case 'S':
+			opts.sub_project = optarg;
+			break;
+		case 'F':
+			opts.format = export_format_from_name(optarg);
+			if (opts.format < 0) {
+				disp_cmd_usage(cmd);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 's':
+			opts.seconds = true;
+			break;
+		case 'h':
+		default:
+			disp_cmd_usage(cmd);
+			return EXIT_FAILURE;
+		}
+	}
+
+	opts.args = argv + optind;
+
+	/* Only via the environment, the report goes to stderr */
+	stats_init(false);
+
+	rc = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READONLY, NULL);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "Cannot open database: %s\n",
+			sqlite3_errmsg(db));
+		goto out_close;
+	}
+	stats_trace_db(db);
+	sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+
+	if (!schema_is_current(db)) {
+		fprintf(stderr, "Database schema is out of date, run tempus "
+			"once to upgrade it\n");
+		goto out_close;
+	}
+
+	if (cmd->func(db, &opts) == 0)
+		ret = EXIT_SUCCESS;
+
+	stats_report(stderr);
+
+out_close:
+	sqlite3_close(db);
+
+	return ret;
+}
@@ -0,0 +1,18 @@
+/*
+ * cli.h - Headless command line interface
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _CLI_H_
+#define _CLI_H_
+
+#include <stdbool.h>
+
+extern bool cli_is_command(const char *name);
+extern int cli_main(const char *db_path, int argc, char **argv);
+
+#endif /* _CLI_H_ */
@@ -0,0 +1,272 @@
+/*
+ * completion.c - Ranked prefix index of names for the entry completions
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "short_types.h"
+#include "completion.h"
+#include "date.h"
+
+/* A name's use count is worth half as much after this many days */
+#define RECENCY_DAYS		30
+
+/* Separates the entity & project in sub_projects scope keys */
+#define SCOPE_SEP		"\x1f"
+
+struct completion_name {
+	char *name;
+	char *key;		/* Case folded name */
+	u32 count;
+	int last_day;		/* Day number last used on */
+};
+
+/*
+ * Names are held in arrays sorted by key, so the names starting with a
+ * given prefix are found with a binary search and are all together.
+ *
+ * Projects are kept per entity and sub projects per entity & project,
+ * as well as all together (the "" scope) for when there's nothing to
+ * go on.
+ */
+struct completion {
+	GPtrArray *entities;
+	GHashTable *projects;
+	GHashTable *sub_projects;
+};
+
+static void free_name(gpointer data)
+{
+	struct completion_name *n = data;
+
+	g_free(n->name);
+	g_free(n->key);
+	g_slice_free(struct completion_name, n);
+}
+
+static void free_names(gpointer data)
+{
+	g_ptr_array_free(data, true);
+}
+
+static GPtrArray *names_new(void)
+{
+	return g_ptr_array_new_with_free_func(free_name);
+}
+
+/* Index of the first name whose key is >= key */
+static guint lower_bound(const GPtrArray *names, const char *key)
+{
+	guint lo = 0;
+	guint hi = names->len;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		const struct completion_name *n = g_ptr_array_index(names,
+								    mid);
+
+		if (strcmp(n->key, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void names_add(GPtrArray *names, const char *name, const char *key,
+		      int day, u32 count)
+{
+	guint i = lower_bound(names, key);
+	struct completion_name *n;
+
+	if (i < names->len) {
+		n = g_ptr_array_index(names, i);
+		if (strcmp(n->key, key) == 0) {
+			n->count += count;
+			if (day > n->last_day)
+				n->last_day = day;
+			return;
+		}
+	}
+
+	n = g_slice_new(struct completion_name);
+	n->name = g_strdup(name);
+	n->key = g_strdup(key);
+	n->count = count;
+	n->last_day = day;
+
+	g_ptr_array_insert(names, i, n);
+}
+
+static GPtrArray *get_scope(GHashTable *scopes, const char *scope)
+{
+	GPtrArray *names = g_hash_table_lookup(scopes, scope);
+
+	if (!names) {
+		names = names_new();
+		g_hash_table_insert(scopes, g_strdup(scope), names);
+	}
+
+	return names;
+}
+
+/* Look up a scope, falling back to all the names if it's not known */
+static const GPtrArray *find_scope(GHashTable *scopes, const char *scope)
+{
+	const GPtrArray *names = g_hash_table_lookup(scopes, scope);
+
+	return names ? names : g_hash_table_lookup(scopes, "");
+}
+
+static double rank(const struct completion_name *n, int now)
+{
+	double age = now > n->last_day ? (double)now - n->last_day : 0;
+
+	return (double)n->count * RECENCY_DAYS / (RECENCY_DAYS + age);
+}
+
+struct completion *completion_new(void)
+{
+	struct completion *c = g_slice_new(struct completion);
+
+	c->entities = names_new();
+	c->projects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					    free_names);
+	c->sub_projects = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, free_names);
+
+	return c;
+}
+
+void completion_free(struct completion *c)
+{
+	if (!c)
+		return;
+
+	g_ptr_array_free(c->entities, true);
+	g_hash_table_destroy(c->projects);
+	g_hash_table_destroy(c->sub_projects);
+	g_slice_free(struct completion, c);
+}
+
+/*
+ * Record count uses of the entity/project/sub_project combination, the
+ * most recent on day (a day number, see date.c). Empty names are
+ * ignored.
+ */
+void completion_add(struct completion *c, const char *entity,
+		    const char *project, const char *sub_project,
+		    int day, u32 count)
+{
+	char *ekey = g_utf8_casefold(entity ? entity : "", -1);
+	char *pkey = g_utf8_casefold(project ? project : "", -1);
+	char *skey = g_utf8_casefold(sub_project ? sub_project : "", -1);
+
+	if (*ekey)
+		names_add(c->entities, entity, ekey, day, count);
+
+	if (*pkey) {
+		names_add(get_scope(c->projects, ""), project, pkey, day,
+			  count);
+		if (*ekey)
+			names_add(get_scope(c->projects, ekey), project, pkey,
+				  day, count);
+	}
+
+	if (*skey) {
+		char *scope = g_strconcat(ekey, SCOPE_SEP, pkey, NULL);
+
+		names_add(get_scope(c->sub_projects, ""), sub_project, skey,
+			  day, count);
+		names_add(get_scope(c->sub_projects, scope), sub_project, skey,
+			  day, count);
+		g_free(scope);
+	}
+
+	g_free(ekey);
+	g_free(pkey);
+	g_free(skey);
+}
+
+/*
+ * Fill matches with up to max names of the given field starting with
+ * prefix (case insensitively), best ranked first. Projects are limited
+ * to those used with entity and sub projects to those used with entity
+ * & project, where they're known.
+ *
+ * The returned names are owned by the index and are only valid until
+ * it's next added to.
+ */
+guint completion_lookup(const struct completion *c,
+			enum completion_field field,
+			const char *entity, const char *project,
+			const char *prefix, const char **matches, guint max)
+{
+	const GPtrArray *names = NULL;
+	double *scores;
+	char *ekey = g_utf8_casefold(entity ? entity : "", -1);
+	char *pkey = g_utf8_casefold(project ? project : "", -1);
+	char *key;
+	char *scope;
+	int now = date_today();
+	guint nr = 0;
+	guint i;
+
+	switch (field) {
+	case COMPLETION_ENTITY:
+		names = c->entities;
+		break;
+	case COMPLETION_PROJECT:
+		names = find_scope(c->projects, ekey);
+		break;
+	case COMPLETION_SUB_PROJECT:
+		scope = g_strconcat(ekey, SCOPE_SEP, pkey, NULL);
+		names = find_scope(c->sub_projects, scope);
+		g_free(scope);
+		break;
+	}
+	g_free(ekey);
+	g_free(pkey);
+
+	if (!names || !max)
+		return 0;
+
+	scores = g_new(double, max);
+	key = g_utf8_casefold(prefix, -1);
+	for (i = lower_bound(names, key); i < names->len; i++) {
+		const struct completion_name *n = g_ptr_array_index(names, i);
+		double score;
+		guint j;
+
+		if (!g_str_has_prefix(n->key, key))
+			break;
+
+		score = rank(n, now);
+		if (nr == max && score <= scores[nr - 1])
+			continue;
+
+		/* Insertion into the (short) list of the best so far */
+		j = nr < max ? nr++ : max - 1;
+		while (j > 0 && scores[j - 1] < score) {
+			scores[j] = scores[j - 1];
+			matches[j] = matches[j - 1];
+			j--;
+		}
+		scores[j] = score;
+		matches[j] = n->name;
+	}
+	g_free(key);
+	g_free(scores);
+
+	return nr;
+}
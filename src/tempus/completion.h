@@ -0,0 +1,36 @@
+/*
+ * completion.h - Ranked prefix index of names for the entry completions
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _COMPLETION_H_
+#define _COMPLETION_H_
+
+#include <glib.h>
+
+#include "short_types.h"
+
+enum completion_field {
+	COMPLETION_ENTITY = 0,
+	COMPLETION_PROJECT,
+	COMPLETION_SUB_PROJECT
+};
+
+struct completion;
+
+extern struct completion *completion_new(void);
+extern void completion_free(struct completion *c);
+extern void completion_add(struct completion *c, const char *entity,
+			   const char *project, const char *sub_project,
+			   int day, u32 count);
+extern guint completion_lookup(const struct completion *c,
+			       enum completion_field field,
+			       const char *entity, const char *project,
+			       const char *prefix, const char **matches,
+			       guint max);
+
+#endif /* _COMPLETION_H_ */
@@ -13,6 +13,8 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <inttypes.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -25,15 +27,21 @@
 #include <tcutil.h>
 #include <tctdb.h>
 
-#include "tempus.h"
+#include "short_types.h"
+#include "db.h"
+#include "schema.h"
 
 #define TEMPUS_TDB		"tempus.tdb"
 #define TEMPUS_SQLITE		"tempus.sqlite"
 
-#define DB_SCHEMA \
-	"CREATE TABLE tempus (id INTEGER PRIMARY KEY, date TEXT, " \
-	"entity TEXT, project TEXT, sub_project TEXT, duration INT, " \
-	"description TEXT)"
+/* Commit the conversion every this many records */
+#define CONVERT_BATCH		10000
+
+/* What was converted, to check against what ended up in the database */
+struct convert_sum {
+	u64 nr_records;
+	u64 checksum;
+};
 
 static int opendir_containing(const char *file)
 {
@@ -68,20 +76,14 @@ static int backup_tdb(int dfd)
 	return err;
 }
 
-static int cleanup_err(int dfd)
+/* Remove what there is of a failed conversion */
+static void cleanup_err(int dfd)
 {
-	struct stat sb;
 	int err;
 
-	err = fstatat(dfd, TEMPUS_SQLITE, &sb, 0);
-	if (err)
-		return 0;
-
-	err = unlinkat(dfd, TEMPUS_SQLITE, 0);
-	if (err)
+	err = unlinkat(dfd, "." TEMPUS_SQLITE, 0);
+	if (err && errno != ENOENT)
 		perror("unlinkat");
-
-	return err;
 }
 
 static void get_sql_tmp_fname(const char *tdb, char *sql)
@@ -104,14 +106,92 @@ static int dur_to_secs(const char *duration)
 	return (hours*3600) + (minutes*60) + seconds;
 }
 
-static int populate_db(const char *tc, sqlite3 *db, bool *do_rename)
+/*
+ * Checksum a record as it's stored in the new database, names are
+ * compared case insensitively (as far as sqlite's NOCASE goes) as each
+ * is only stored once with whichever case it was first seen in.
+ */
+static u64 hash_str(u64 hash, const char *str, bool nocase)
+{
+	if (!str)
+		str = "";
+
+	do {
+		unsigned char c = *str;
+
+		if (nocase && c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		/* FNV-1a, including the terminating NUL */
+		hash ^= c;
+		hash *= 0x100000001b3ULL;
+	} while (*str++);
+
+	return hash;
+}
+
+static void sum_record(struct convert_sum *sum, const char *date,
+		       const char *entity, const char *project,
+		       const char *sub_project, int duration,
+		       const char *description)
 {
-	sqlite3_stmt *stmt;
+	u64 hash = 0xcbf29ce484222325ULL;
+	char dur[16];
+
+	snprintf(dur, sizeof(dur), "%d", duration);
+
+	hash = hash_str(hash, date, false);
+	hash = hash_str(hash, entity, true);
+	hash = hash_str(hash, project, true);
+	hash = hash_str(hash, sub_project, true);
+	hash = hash_str(hash, dur, false);
+	hash = hash_str(hash, description, false);
+
+	/* Added up, so it doesn't matter what order the records come in */
+	sum->nr_records++;
+	sum->checksum += hash;
+}
+
+static int exec_sql(sqlite3 *db, const char *sql)
+{
+	int rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+
+	if (rc == SQLITE_OK)
+		return 0;
+
+	fprintf(stderr, "sqlite execution failed: %s\n", sqlite3_errmsg(db));
+
+	return -1;
+}
+
+static void show_progress(u64 done, u64 total, bool last)
+{
+	if (!isatty(STDOUT_FILENO) && !last)
+		return;
+
+	printf("\r%" PRIu64 "/%" PRIu64 " records", done, total);
+	if (last)
+		putchar('\n');
+	fflush(stdout);
+}
+
+/*
+ * Copy the records across in date order, as earlier conversions did, so
+ * the entry ids follow the dates. Only the primary keys are held, each
+ * record is fetched as it's copied, committing every CONVERT_BATCH
+ * records. The checksum of what was read is left in sum for
+ * verify_db().
+ */
+static int populate_db(const char *tc, sqlite3 *db, bool *do_rename,
+		       struct convert_sum *sum)
+{
+	sqlite3_stmt *names_stmt = NULL;
+	sqlite3_stmt *stmt = NULL;
 	TCTDB *tdb;
-	TDBQRY *qry;
-	TCLIST *res;
+	TDBQRY *qry = NULL;
+	TCLIST *pks = NULL;
+	TCMAP *cols;
+	u64 nr_records;
 	int i;
-	int nr;
 	int rc;
 	int ret = -1;
 
@@ -123,71 +203,177 @@ static int populate_db(const char *tc, sqlite3 *db, bool *do_rename)
 		return 0; /* OK, no TCTDB to convert... */
 	}
 
+	rc = sqlite3_prepare_v2(db, SQL_ADD_NAMES, -1, &names_stmt, NULL);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "sqlite prepare failed: %s\n",
+			sqlite3_errmsg(db));
+		goto out_cleanup;
+	}
+
 	rc = sqlite3_prepare_v2(db, SQL_INSERT, -1, &stmt, NULL);
 	if (rc != SQLITE_OK) {
 		fprintf(stderr, "sqlite prepare failed: %s\n",
 			sqlite3_errmsg(db));
-		return ret;
+		goto out_cleanup;
 	}
 
 	fprintf(stdout,
 		"Converting tempus.tdb -> tempus.sqlite "
 		"(Backing up tempus.tdb -> tempus.tdb.bak)\n");
 
+	nr_records = tctdbrnum(tdb);
+	if (exec_sql(db, "BEGIN") == -1)
+		goto out_cleanup;
+
 	qry = tctdbqrynew(tdb);
 	tctdbqrysetorder(qry, "date", TDBQOSTRASC);
-	res = tctdbqrysearch(qry);
-	nr = tclistnum(res);
-	for (i = 0; i < nr; i++) {
-		int rc;
+	pks = tctdbqrysearch(qry);
+	for (i = 0; i < tclistnum(pks); i++) {
+		int pk_size;
+		const char *pk = tclistval(pks, i, &pk_size);
+		const char *date;
+		const char *entity;
+		const char *project;
+		const char *sub_project;
+		const char *description;
+		const char *hours;
 		int duration;
-		int rsize;
-		const char *pkbuf = tclistval(res, i, &rsize);
-		TCMAP *cols = tctdbget(tdb, pkbuf, rsize);
-
-		tcmapiterinit(cols);
-
-		sqlite3_bind_text(stmt, 1, tcmapget2(cols, "date"), -1, NULL);
-		sqlite3_bind_text(stmt, 2, tcmapget2(cols, "company"), -1,
-				  NULL);
-		sqlite3_bind_text(stmt, 3, tcmapget2(cols, "project"), -1,
-				  NULL);
-		sqlite3_bind_text(stmt, 4, tcmapget2(cols, "sub_project"), -1,
-				  NULL);
-		duration = dur_to_secs(tcmapget2(cols, "hours"));
-		sqlite3_bind_int(stmt, 5, duration);
-		sqlite3_bind_text(stmt, 6, tcmapget2(cols, "description"), -1,
-				  NULL);
 
-		rc = sqlite3_step(stmt);
+		cols = tctdbget(tdb, pk, pk_size);
+		if (!cols) {
+			fprintf(stderr, "Cannot read record %.*s from %s\n",
+				pk_size, pk, tc);
+			goto out_rollback;
+		}
+
+		date = tcmapget2(cols, "date");
+		entity = tcmapget2(cols, "company");
+		project = tcmapget2(cols, "project");
+		sub_project = tcmapget2(cols, "sub_project");
+		description = tcmapget2(cols, "description");
+		hours = tcmapget2(cols, "hours");
+		duration = hours ? dur_to_secs(hours) : 0;
+
+		sqlite3_bind_text(names_stmt, 1, entity, -1, NULL);
+		sqlite3_bind_text(names_stmt, 2, project, -1, NULL);
+		sqlite3_bind_text(names_stmt, 3, sub_project, -1, NULL);
+		rc = sqlite3_step(names_stmt);
+		sqlite3_reset(names_stmt);
 		if (rc != SQLITE_DONE) {
 			fprintf(stderr, "sqlite execution failed: %s\n",
 				sqlite3_errmsg(db));
 			tcmapdel(cols);
-			goto out_cleanup;
-
+			goto out_rollback;
 		}
+
+		sqlite3_bind_text(stmt, 1, date, -1, NULL);
+		sqlite3_bind_text(stmt, 2, entity, -1, NULL);
+		sqlite3_bind_text(stmt, 3, project, -1, NULL);
+		sqlite3_bind_text(stmt, 4, sub_project, -1, NULL);
+		sqlite3_bind_int(stmt, 5, duration);
+		sqlite3_bind_text(stmt, 6, description, -1, NULL);
+		rc = sqlite3_step(stmt);
 		sqlite3_reset(stmt);
+		if (rc != SQLITE_DONE) {
+			fprintf(stderr, "sqlite execution failed: %s\n",
+				sqlite3_errmsg(db));
+			tcmapdel(cols);
+			goto out_rollback;
+		}
 
+		sum_record(sum, date, entity, project, sub_project, duration,
+			   description);
 		tcmapdel(cols);
+
+		if (sum->nr_records % CONVERT_BATCH == 0) {
+			if (exec_sql(db, "COMMIT; BEGIN") == -1)
+				goto out_rollback;
+			show_progress(sum->nr_records, nr_records, false);
+		}
+	}
+
+	if (exec_sql(db, "COMMIT") == -1)
+		goto out_rollback;
+	show_progress(sum->nr_records, nr_records, true);
+
+	if (sum->nr_records != nr_records) {
+		fprintf(stderr, "Only read %" PRIu64 " of %" PRIu64
+			" records from %s\n", sum->nr_records, nr_records, tc);
+		goto out_cleanup;
 	}
 
 	ret = 0;
+	goto out_cleanup;
 
+out_rollback:
+	sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
 out_cleanup:
 	sqlite3_finalize(stmt);
+	sqlite3_finalize(names_stmt);
 
-	tclistdel(res);
-	tctdbqrydel(qry);
+	if (pks)
+		tclistdel(pks);
+	if (qry)
+		tctdbqrydel(qry);
 	tctdbclose(tdb);
 	tctdbdel(tdb);
 
 	return ret;
 }
 
+/*
+ * Read back everything that was converted, checking it all made it &
+ * is the same as what was read from the tdb.
+ */
+static int verify_db(sqlite3 *db, const struct convert_sum *tdb_sum)
+{
+	struct convert_sum sum = { 0 };
+	sqlite3_stmt *stmt;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db, "SELECT date, entity, project, "
+				"sub_project, duration, description "
+				"FROM tempus", -1, &stmt, NULL);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "sqlite prepare failed: %s\n",
+			sqlite3_errmsg(db));
+		return -1;
+	}
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+		sum_record(&sum,
+			   (const char *)sqlite3_column_text(stmt, 0),
+			   (const char *)sqlite3_column_text(stmt, 1),
+			   (const char *)sqlite3_column_text(stmt, 2),
+			   (const char *)sqlite3_column_text(stmt, 3),
+			   sqlite3_column_int(stmt, 4),
+			   (const char *)sqlite3_column_text(stmt, 5));
+	sqlite3_finalize(stmt);
+
+	if (rc != SQLITE_DONE) {
+		fprintf(stderr, "sqlite execution failed: %s\n",
+			sqlite3_errmsg(db));
+		return -1;
+	}
+
+	if (sum.nr_records != tdb_sum->nr_records ||
+	    sum.checksum != tdb_sum->checksum) {
+		fprintf(stderr,
+			"Conversion check failed: tempus.tdb has %" PRIu64
+			" records (checksum %016" PRIx64 "), tempus.sqlite "
+			"has %" PRIu64 " (checksum %016" PRIx64 ")\n",
+			tdb_sum->nr_records, tdb_sum->checksum,
+			sum.nr_records, sum.checksum);
+		return -1;
+	}
+
+	return 0;
+}
+
 int convert_db(const char *tdb)
 {
 	char sql_file[NAME_MAX + 1];
+	struct convert_sum sum = { 0 };
 	struct stat sb;
 	sqlite3 *db;
 	bool do_rename = true;
@@ -229,14 +415,15 @@ int convert_db(const char *tdb)
 	}
 
 	/* Create DB schema... */
-	rc = sqlite3_exec(db, DB_SCHEMA, 0, 0, NULL);
-	if (rc != SQLITE_OK) {
-		fprintf(stderr, "Cannot create database schema: %s\n",
-			sqlite3_errmsg(db));
+	err = schema_migrate(db);
+	if (err)
+		goto out_close;
+
+	err = populate_db(tdb, db, &do_rename, &sum);
+	if (err)
 		goto out_close;
-	}
 
-	err = populate_db(tdb, db, &do_rename);
+	err = verify_db(db, &sum);
 	if (err)
 		goto out_close;
 
@@ -254,7 +441,7 @@ int convert_db(const char *tdb)
 	if (ret == 0 && do_rename)
 		ret = backup_tdb(dfd);
 	else if (ret == -1)
-		ret = cleanup_err(dfd);
+		cleanup_err(dfd);
 
 	close(dfd);
 
@@ -0,0 +1,393 @@
+/*
+ * ctl.c - Line protocol of tempusd's control socket
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#define _GNU_SOURCE			/* SOCK_CLOEXEC, MSG_NOSIGNAL */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "ctl.h"
+
+/*
+ * A request is a command followed by its arguments & the reply is OK or
+ * ERR followed by whatever it has to say, tab separated on one line, e.g
+ *
+ *	switch	Acme	Widgets	Testing
+ *	OK	running	0	Acme	Widgets	Testing	-1
+ *
+ *	stop
+ *	ERR	Not recording
+ *
+ * Fields are escaped with g_strescape(), so they can't contain a tab or
+ * newline. A connection can carry any number of requests, each of which
+ * is replied to in turn. After a watch request, EV lines with the state
+ * of the recording are sent whenever it changes, in between any replies.
+ */
+
+/* How long to wait on an unresponsive tempusd */
+#define CTL_TIMEOUT_SECS	5
+
+#define CTL_READ_SIZE		4096
+
+/* How long to give tempusd to start up */
+#define CTL_START_TRIES		50
+#define CTL_START_WAIT_US	(50 * 1000)
+
+struct pending {
+	ctl_reply_fn fn;
+	void *data;
+};
+
+/* A connection to tempusd driven by the main loop, see ctl_conn_new() */
+struct ctl_conn {
+	int fd;
+	guint source;
+	GString *in;		/* Read but not yet handled */
+	GQueue pending;		/* Of struct pending, awaiting replies */
+
+	ctl_reply_fn event_fn;
+	void *event_data;
+};
+
+char *ctl_socket_path(void)
+{
+	return g_strdup_printf(CTL_SOCKET, getenv("HOME"));
+}
+
+/* The line for word & the NULL terminated args, to be g_free()'d */
+char *ctl_join(const char *word, const char * const *args)
+{
+	GString *line = g_string_new(word);
+
+	for (; args && *args; args++) {
+		char *esc = g_strescape(*args, NULL);
+
+		g_string_append_c(line, '\t');
+		g_string_append(line, esc);
+		g_free(esc);
+	}
+	g_string_append_c(line, '\n');
+
+	return g_string_free(line, false);
+}
+
+/* Split a line into its fields, to be freed with g_strfreev() */
+char **ctl_split(const char *line)
+{
+	char *str = g_strchomp(g_strdup(line));
+	char **fields = g_strsplit(str, "\t", -1);
+	int i;
+
+	for (i = 0; fields[i]; i++) {
+		char *field = g_strcompress(fields[i]);
+
+		g_free(fields[i]);
+		fields[i] = field;
+	}
+	g_free(str);
+
+	return fields;
+}
+
+/*
+ * Connect to tempusd, quietly, so the caller can decide what to make of
+ * it not running (errno is ENOENT or ECONNREFUSED).
+ *
+ * Returns the socket, or -1 on error.
+ */
+int ctl_connect(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct timeval tv = { .tv_sec = CTL_TIMEOUT_SECS };
+	char *path = ctl_socket_path();
+	int fd = -1;
+	int err;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		goto out_free;
+	}
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		goto out_free;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		err = errno;
+		close(fd);
+		fd = -1;
+		errno = err;
+	}
+
+out_free:
+	g_free(path);
+
+	return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t bytes = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += bytes;
+		len -= bytes;
+	}
+
+	return 0;
+}
+
+/* So it carries on when we're gone, whatever they took with them */
+static void tempusd_setup(gpointer data __attribute__((unused)))
+{
+	setsid();
+}
+
+/*
+ * Connect to tempusd, starting it if it isn't running & giving it a
+ * little while to get going. Its output goes to /dev/null, so it doesn't
+ * hold open a pipe we were run with.
+ *
+ * Returns the socket, or -1 on error.
+ */
+int ctl_connect_start(void)
+{
+	char *argv[] = { "tempusd", NULL };
+	GError *error = NULL;
+	int fd = ctl_connect();
+	int i;
+
+	if (fd != -1 || (errno != ENOENT && errno != ECONNREFUSED))
+		return fd;
+
+	if (!g_spawn_async(NULL, argv, NULL, G_SPAWN_SEARCH_PATH |
+			   G_SPAWN_STDOUT_TO_DEV_NULL, tempusd_setup, NULL,
+			   NULL, &error)) {
+		fprintf(stderr, "Cannot start tempusd: %s\n", error->message);
+		g_error_free(error);
+		errno = ENOENT;
+		return -1;
+	}
+
+	for (i = 0; i < CTL_START_TRIES && fd == -1; i++) {
+		g_usleep(CTL_START_WAIT_US);
+		fd = ctl_connect();
+	}
+
+	return fd;
+}
+
+/*
+ * Send request (a line from ctl_join()) to tempusd, starting it if need
+ * be, & wait for its reply, which is returned in reply without the
+ * newline, to be g_free()'d.
+ *
+ * Returns 0 on success, -1 if tempusd couldn't be talked to.
+ */
+int ctl_request(const char *request, char **reply)
+{
+	GString *in;
+	char *nl = NULL;
+	int fd = ctl_connect_start();
+	int err = -1;
+
+	if (fd == -1) {
+		if (errno == ENOENT || errno == ECONNREFUSED)
+			fprintf(stderr, "tempusd isn't running\n");
+		else
+			fprintf(stderr, "Cannot connect to tempusd: %s\n",
+				strerror(errno));
+		return -1;
+	}
+
+	if (write_all(fd, request, strlen(request)) == -1) {
+		perror("send");
+		close(fd);
+		return -1;
+	}
+
+	in = g_string_sized_new(CTL_READ_SIZE);
+	while (!nl) {
+		ssize_t bytes;
+
+		if (in->len >= CTL_LINE_MAX) {
+			fprintf(stderr, "Reply from tempusd too long\n");
+			goto out_close;
+		}
+
+		g_string_set_size(in, in->len + CTL_READ_SIZE);
+		bytes = read(fd, in->str + in->len - CTL_READ_SIZE,
+			     CTL_READ_SIZE);
+		g_string_set_size(in, in->len - CTL_READ_SIZE +
+				  (bytes > 0 ? bytes : 0));
+		if (bytes == -1 && errno == EINTR)
+			continue;
+		if (bytes <= 0) {
+			fprintf(stderr, "No reply from tempusd\n");
+			goto out_close;
+		}
+		nl = memchr(in->str, '\n', in->len);
+	}
+
+	*reply = g_strndup(in->str, nl - in->str);
+	err = 0;
+
+out_close:
+	g_string_free(in, true);
+	close(fd);
+
+	return err;
+}
+
+/* tempusd has gone, tell whoever's waiting */
+static void conn_lost(struct ctl_conn *conn)
+{
+	struct pending *p;
+
+	if (conn->source)
+		g_source_remove(conn->source);
+	conn->source = 0;
+	if (conn->fd != -1)
+		close(conn->fd);
+	conn->fd = -1;
+
+	while ((p = g_queue_pop_head(&conn->pending))) {
+		p->fn(NULL, p->data);
+		g_slice_free(struct pending, p);
+	}
+	conn->event_fn(NULL, conn->event_data);
+}
+
+static void conn_handle_line(struct ctl_conn *conn, const char *line)
+{
+	char **fields = ctl_split(line);
+	struct pending *p;
+
+	if (fields[0] && strcmp(fields[0], "EV") == 0) {
+		conn->event_fn(fields, conn->event_data);
+	} else {
+		p = g_queue_pop_head(&conn->pending);
+		if (p) {
+			p->fn(fields, p->data);
+			g_slice_free(struct pending, p);
+		}
+	}
+
+	g_strfreev(fields);
+}
+
+static gboolean cb_conn_read(gint fd, GIOCondition condition
+			     __attribute__((unused)), gpointer data)
+{
+	struct ctl_conn *conn = data;
+	char buf[CTL_READ_SIZE];
+	ssize_t bytes;
+	char *nl;
+
+	bytes = read(fd, buf, sizeof(buf));
+	if (bytes == -1 && (errno == EINTR || errno == EAGAIN))
+		return G_SOURCE_CONTINUE;
+	if (bytes <= 0 || conn->in->len + bytes > CTL_LINE_MAX) {
+		conn->source = 0;
+		conn_lost(conn);
+		return G_SOURCE_REMOVE;
+	}
+
+	g_string_append_len(conn->in, buf, bytes);
+	while ((nl = memchr(conn->in->str, '\n', conn->in->len))) {
+		char *line = g_strndup(conn->in->str, nl - conn->in->str);
+
+		g_string_erase(conn->in, 0, nl - conn->in->str + 1);
+		conn_handle_line(conn, line);
+		g_free(line);
+
+		/* Lost while sending from a callback */
+		if (conn->fd == -1)
+			return G_SOURCE_REMOVE;
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Talk to tempusd over fd (from ctl_connect()) from the main loop. Its
+ * replies are passed to the callbacks given to ctl_conn_send(), in the
+ * order the requests were sent, & any events to event_fn. If the
+ * connection is lost, they're all called with NULL.
+ */
+struct ctl_conn *ctl_conn_new(int fd, ctl_reply_fn event_fn, void *data)
+{
+	struct ctl_conn *conn = g_slice_new0(struct ctl_conn);
+
+	conn->fd = fd;
+	conn->in = g_string_new(NULL);
+	g_queue_init(&conn->pending);
+	conn->event_fn = event_fn;
+	conn->event_data = data;
+	conn->source = g_unix_fd_add(fd, G_IO_IN | G_IO_HUP | G_IO_ERR,
+				     cb_conn_read, conn);
+
+	return conn;
+}
+
+/*
+ * Send request (a line from ctl_join()), fn is called with the reply.
+ * If the connection has gone, that's straight away.
+ */
+void ctl_conn_send(struct ctl_conn *conn, const char *request,
+		   ctl_reply_fn fn, void *data)
+{
+	struct pending *p;
+
+	if (conn->fd == -1 ||
+	    write_all(conn->fd, request, strlen(request)) == -1) {
+		if (conn->fd != -1)
+			conn_lost(conn);
+		fn(NULL, data);
+		return;
+	}
+
+	p = g_slice_new(struct pending);
+	p->fn = fn;
+	p->data = data;
+	g_queue_push_tail(&conn->pending, p);
+}
+
+/* Any replies still to come are dropped, without calling back */
+void ctl_conn_free(struct ctl_conn *conn)
+{
+	struct pending *p;
+
+	if (conn->source)
+		g_source_remove(conn->source);
+	if (conn->fd != -1)
+		close(conn->fd);
+	while ((p = g_queue_pop_head(&conn->pending)))
+		g_slice_free(struct pending, p);
+	g_string_free(conn->in, true);
+	g_slice_free(struct ctl_conn, conn);
+}
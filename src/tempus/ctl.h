@@ -0,0 +1,40 @@
+/*
+ * ctl.h - Line protocol of tempusd's control socket
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _CTL_H_
+#define _CTL_H_
+
+/* Formatted with $HOME */
+#define CTL_SOCKET	"%s/.local/share/tempus/tempusd.sock"
+
+/* The longest request or reply line, including the newline */
+#define CTL_LINE_MAX	(256 * 1024)
+
+/*
+ * Called with a reply or event split into its fields, or NULL if the
+ * connection to tempusd has gone.
+ */
+typedef void (*ctl_reply_fn)(char **fields, void *data);
+
+struct ctl_conn;
+
+extern char *ctl_socket_path(void);
+extern char *ctl_join(const char *word, const char * const *args);
+extern char **ctl_split(const char *line);
+extern int ctl_connect(void);
+extern int ctl_connect_start(void);
+extern int ctl_request(const char *request, char **reply);
+
+extern struct ctl_conn *ctl_conn_new(int fd, ctl_reply_fn event_fn,
+				     void *data);
+extern void ctl_conn_send(struct ctl_conn *conn, const char *request,
+			  ctl_reply_fn fn, void *data);
+extern void ctl_conn_free(struct ctl_conn *conn);
+
+#endif /* _CTL_H_ */
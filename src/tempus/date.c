@@ -0,0 +1,165 @@
+/*
+ * date.c - Dates as day numbers
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#define _POSIX_C_SOURCE	200809L		/* localtime_r(3) */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "date.h"
+
+/*
+ * Dates are handled as the number of days since 1970-01-01 (in the
+ * proleptic Gregorian calendar), so comparing, stepping & working out
+ * the day of the week are simple arithmetic.
+ */
+
+/* Set this to the number of seconds past midnight a new day should start */
+static const int new_day_offset = 16200; /* 0430 */
+
+static bool is_leap_year(int year)
+{
+	return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+static int days_in_month(int year, int month)
+{
+	static const int days[] = {
+		31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+	};
+
+	if (month == 2 && is_leap_year(year))
+		return 29;
+
+	return days[month - 1];
+}
+
+/* Years are counted from March so the leap day comes last */
+static int days_from_civil(int year, int month, int day)
+{
+	int era;
+	int yoe;
+	int doy;
+	int doe;
+
+	year -= month <= 2;
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+static void civil_from_days(int days, int *year, int *month, int *day)
+{
+	int era;
+	int doe;
+	int yoe;
+	int doy;
+	int mp;
+
+	days += 719468;
+	era = (days >= 0 ? days : days - 146096) / 146097;
+	doe = days - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+
+	*day = doy - (153 * mp + 2) / 5 + 1;
+	*month = mp < 10 ? mp + 3 : mp - 9;
+	*year = yoe + era * 400 + (*month <= 2);
+}
+
+static int parse_digits(const char *s, int n)
+{
+	int v = 0;
+
+	while (n--) {
+		if (*s < '0' || *s > '9')
+			return -1;
+		v = v * 10 + (*s++ - '0');
+	}
+
+	return v;
+}
+
+/* Convert a YYYY-MM-DD date to a day number, DATE_NONE if it's invalid */
+int date_to_day(const char *date)
+{
+	int year;
+	int month;
+	int day;
+
+	if (!date || strlen(date) != 10 || date[4] != '-' || date[7] != '-')
+		return DATE_NONE;
+
+	year = parse_digits(date, 4);
+	month = parse_digits(date + 5, 2);
+	day = parse_digits(date + 8, 2);
+	if (year < 0 || month < 1 || month > 12 || day < 1 ||
+	    day > days_in_month(year, month))
+		return DATE_NONE;
+
+	return days_from_civil(year, month, day);
+}
+
+/* Format a day number as YYYY-MM-DD into buf (DATE_STR_LEN bytes) */
+char *date_from_day(int day, char *buf, size_t len)
+{
+	int y;
+	int m;
+	int d;
+
+	civil_from_days(day, &y, &m, &d);
+	snprintf(buf, len, "%04d-%02d-%02d", y, m, d);
+
+	return buf;
+}
+
+/* 1 (Monday) - 7 (Sunday), 1970-01-01 was a Thursday */
+int date_day_of_week(int day)
+{
+	return ((day + 3) % 7 + 7) % 7 + 1;
+}
+
+/*
+ * Today's day number, where days start new_day_offset seconds past
+ * (local) midnight.
+ *
+ * The local time is only looked at once a day, when the current day
+ * ends. Only to be called from the main thread.
+ */
+int date_today(void)
+{
+	static int today = DATE_NONE;
+	static time_t today_ends;
+	time_t now = time(NULL);
+	time_t then;
+	struct tm tm;
+
+	if (now < today_ends)
+		return today;
+
+	then = now - new_day_offset;
+	localtime_r(&then, &tm);
+	today = days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+
+	/* new_day_offset into the next day, letting mktime() normalise it */
+	tm.tm_mday++;
+	tm.tm_hour = 0;
+	tm.tm_min = 0;
+	tm.tm_sec = new_day_offset;
+	tm.tm_isdst = -1;
+	today_ends = mktime(&tm);
+
+	return today;
+}
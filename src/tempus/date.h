@@ -0,0 +1,33 @@
+/*
+ * date.h - Dates as day numbers
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _DATE_H_
+#define _DATE_H_
+
+#include <stddef.h>
+#include <limits.h>
+
+/* Returned for anything that isn't a valid YYYY-MM-DD date */
+#define DATE_NONE	INT_MIN
+/* Later than any real date */
+#define DATE_MAX	INT_MAX
+
+/* YYYY-MM-DD + '\0' */
+#define DATE_STR_LEN	11
+
+/* The SQL equivalent of date_to_day(), NULL for invalid dates */
+#define DATE_SQL_DAY(d) \
+	"CAST(julianday(" d ") - 2440587.5 AS INTEGER)"
+
+extern int date_to_day(const char *date);
+extern char *date_from_day(int day, char *buf, size_t len);
+extern int date_day_of_week(int day);
+extern int date_today(void);
+
+#endif /* _DATE_H_ */
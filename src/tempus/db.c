@@ -0,0 +1,326 @@
+/*
+ * db.c - Database connection & prepared statement cache
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <sqlite3.h>
+
+#include <glib.h>
+
+#include "schema.h"
+#include "stats.h"
+#include "db.h"
+
+static const char * const db_sql[DB_STMT_MAX] = {
+	[DB_STMT_HISTORY]	= SQL_HISTORY,
+	[DB_STMT_ADD_NAMES]	= SQL_ADD_NAMES,
+	[DB_STMT_INSERT]	= SQL_INSERT,
+	[DB_STMT_UPDATE]	= SQL_UPDATE,
+	[DB_STMT_SUMMARIES]	= SQL_SUMMARIES,
+	[DB_STMT_SUMMARIES_COUNT] = SQL_SUMMARIES_COUNT,
+	[DB_STMT_COMPLETIONS]	= SQL_COMPLETIONS,
+	[DB_STMT_ROLLUPS]	= SQL_ROLLUPS,
+	[DB_STMT_RANGE_TOTALS]	= SQL_RANGE_TOTALS,
+	[DB_STMT_SEARCH]	= SQL_SEARCH,
+	[DB_STMT_EXPORT]	= SQL_EXPORT,
+	[DB_STMT_DESCRIPTION]	= SQL_DESCRIPTION,
+	[DB_STMT_HISTORY_SINCE]	= SQL_HISTORY_SINCE,
+	[DB_STMT_SNAPSHOT_KEY]	= SQL_SNAPSHOT_KEY,
+};
+
+struct db_job {
+	db_work_fn work;
+	GSourceFunc done;
+	void *data;
+};
+
+static sqlite3 *db;
+static sqlite3_stmt *stmts[DB_STMT_MAX];
+
+static GAsyncQueue *jobs;
+static GThread *worker;
+
+static gpointer db_worker(gpointer data __attribute__((unused)))
+{
+	for (;;) {
+		struct db_job *job = g_async_queue_pop(jobs);
+
+		/* A job with no work is the signal to exit */
+		if (!job->work) {
+			g_slice_free(struct db_job, job);
+			break;
+		}
+
+		job->work(job->data);
+		if (job->done)
+			g_idle_add_full(G_PRIORITY_DEFAULT, job->done,
+					job->data, NULL);
+
+		g_slice_free(struct db_job, job);
+	}
+
+	return NULL;
+}
+
+static void db_worker_stop(void)
+{
+	struct db_job *job;
+
+	if (!worker)
+		return;
+
+	/* Queued jobs are run first, so pending saves aren't lost */
+	job = g_slice_new0(struct db_job);
+	g_async_queue_push(jobs, job);
+	g_thread_join(worker);
+	g_async_queue_unref(jobs);
+
+	worker = NULL;
+	jobs = NULL;
+}
+
+/*
+ * Queue up work to be run against the database on the database thread.
+ * Jobs are run in the order they are submitted, once complete done (if
+ * not NULL) is called from the main loop with the same data.
+ *
+ * The database connection & its statements must only be used from
+ * within work functions.
+ */
+void db_submit(db_work_fn work, GSourceFunc done, void *data)
+{
+	struct db_job *job = g_slice_new(struct db_job);
+
+	if (!worker) {
+		jobs = g_async_queue_new();
+		worker = g_thread_new("db", db_worker, NULL);
+	}
+
+	job->work = work;
+	job->done = done;
+	job->data = data;
+
+	g_async_queue_push(jobs, job);
+}
+
+/*
+ * Open the database, bring its schema up to date and prepare all our
+ * statements. The connection and statements then live until db_close().
+ *
+ * A read_only connection leaves the schema to whoever does the writing,
+ * it just has to be up to date.
+ */
+int db_open(const char *path, bool read_only)
+{
+	u64 open_start = stats_begin();
+	u64 start;
+	int i;
+	int rc;
+
+	rc = sqlite3_open_v2(path, &db, read_only ? SQLITE_OPEN_READONLY :
+			     SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "Cannot open database: %s\n",
+			sqlite3_errmsg(db));
+		goto out_close;
+	}
+	stats_trace_db(db);
+	sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+
+	if (read_only && !schema_is_current(db)) {
+		fprintf(stderr, "Database schema is out of date\n");
+		goto out_close;
+	}
+
+	start = stats_begin();
+	if (!read_only && schema_migrate(db) != 0)
+		goto out_close;
+	stats_end(STAT_DB_MIGRATE, start);
+
+	for (i = 0; i < DB_STMT_MAX; i++) {
+		start = stats_begin();
+		rc = sqlite3_prepare_v3(db, db_sql[i], -1,
+					SQLITE_PREPARE_PERSISTENT, &stmts[i],
+					NULL);
+		if (rc != SQLITE_OK) {
+			fprintf(stderr, "sqlite prepare failed: %s\n",
+				sqlite3_errmsg(db));
+			goto out_close;
+		}
+		stats_end(STAT_DB_PREPARE, start);
+	}
+	stats_end(STAT_DB_OPEN, open_start);
+
+	return 0;
+
+out_close:
+	db_close();
+
+	return -1;
+}
+
+void db_close(void)
+{
+	int i;
+
+	db_worker_stop();
+
+	for (i = 0; i < DB_STMT_MAX; i++) {
+		sqlite3_finalize(stmts[i]);
+		stmts[i] = NULL;
+	}
+
+	sqlite3_close(db);
+	db = NULL;
+}
+
+sqlite3 *db_get(void)
+{
+	return db;
+}
+
+/*
+ * Return the requested prepared statement ready to have its parameters
+ * bound. Callers should sqlite3_reset() it when they are done so it
+ * doesn't hold a transaction open.
+ */
+sqlite3_stmt *db_stmt(enum db_stmt which)
+{
+	sqlite3_stmt *stmt = stmts[which];
+
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	return stmt;
+}
+
+/*
+ * Save an entry along with any new names, *id is -1 for a new entry
+ * and is then set to its id. Only to be called from a work function.
+ *
+ * Returns 0 on success, -1 on error, with nothing saved.
+ */
+int db_save_entry(gint64 *id, const char *date, const char *entity,
+		  const char *project, const char *sub_project, int duration,
+		  const char *description)
+{
+	sqlite3_stmt *stmt;
+	int rc;
+
+	/*
+	 * New names & the entry go in together. Take the write lock up
+	 * front, so if tempusd or tempus has it, we wait on it.
+	 */
+	rc = sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+	if (rc != SQLITE_OK)
+		goto out_rollback;
+
+	stmt = db_stmt(DB_STMT_ADD_NAMES);
+	sqlite3_bind_text(stmt, 1, entity, -1, NULL);
+	sqlite3_bind_text(stmt, 2, project, -1, NULL);
+	sqlite3_bind_text(stmt, 3, sub_project, -1, NULL);
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	if (rc != SQLITE_DONE)
+		goto out_rollback;
+
+	stmt = db_stmt(*id == -1 ? DB_STMT_INSERT : DB_STMT_UPDATE);
+
+	sqlite3_bind_text(stmt, 1, date, -1, NULL);
+	sqlite3_bind_text(stmt, 2, entity, -1, NULL);
+	sqlite3_bind_text(stmt, 3, project, -1, NULL);
+	sqlite3_bind_text(stmt, 4, sub_project, -1, NULL);
+	sqlite3_bind_int(stmt, 5, duration);
+	sqlite3_bind_text(stmt, 6, description, -1, NULL);
+	if (*id > -1)
+		sqlite3_bind_int64(stmt, 7, *id);
+
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+	if (rc != SQLITE_DONE)
+		goto out_rollback;
+
+	rc = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+	if (rc != SQLITE_OK)
+		goto out_rollback;
+
+	if (*id == -1)
+		*id = sqlite3_last_insert_rowid(db);
+
+	return 0;
+
+out_rollback:
+	fprintf(stderr, "sqlite execution failed: %s\n", sqlite3_errmsg(db));
+	sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+
+	return -1;
+}
+
+/*
+ * Turn what was typed into a search box into an FTS5 query, so it can't
+ * be a syntax error. Every term has to match, words as prefixes (to
+ * match as they're typed) & "quoted text" as a phrase, optionally
+ * followed by a * to match its last word as a prefix.
+ *
+ * Returns NULL if there is nothing to search for, otherwise it's to be
+ * freed with g_free().
+ */
+char *db_fts_query(const char *text)
+{
+	GString *query = g_string_new(NULL);
+
+	while (*text) {
+		const char *end;
+		bool phrase = *text == '"';
+		bool prefix;
+
+		if (g_ascii_isspace(*text)) {
+			text++;
+			continue;
+		}
+
+		if (phrase) {
+			text++;
+			end = strchr(text, '"');
+			if (!end)
+				end = text + strlen(text);
+		} else {
+			end = text;
+			while (*end && *end != '"' && !g_ascii_isspace(*end))
+				end++;
+		}
+
+		prefix = !phrase || (*end && end[1] == '*');
+		if (end > text) {
+			if (query->len)
+				g_string_append_c(query, ' ');
+			g_string_append_c(query, '"');
+			g_string_append_len(query, text, end - text);
+			g_string_append_c(query, '"');
+			if (prefix)
+				g_string_append_c(query, '*');
+		}
+
+		text = end;
+		/* Skip a phrase's closing quote & any * */
+		if (phrase && *text)
+			text++;
+		if (phrase && *text == '*')
+			text++;
+	}
+
+	if (!query->len) {
+		g_string_free(query, true);
+		return NULL;
+	}
+
+	return g_string_free(query, false);
+}
@@ -0,0 +1,210 @@
+/*
+ * db.h - Database connection & prepared statement cache
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _DB_H_
+#define _DB_H_
+
+#include <stdbool.h>
+
+#include <sqlite3.h>
+
+#include <glib.h>
+
+#include "date.h"
+
+/*
+ * tempusd does the writing, while tempus & the command line read, wait
+ * this long for one to finish with it rather than failing.
+ */
+#define DB_BUSY_TIMEOUT_MS	5000
+
+enum sql_column {
+	SQL_COL_ID = 0,
+	SQL_COL_DATE,
+	SQL_COL_ENTITY,
+	SQL_COL_PROJECT,
+	SQL_COL_SUB_PROJECT,
+	SQL_COL_DURATION,
+	SQL_COL_DESCRIPTION,
+	SQL_COL_DAY
+};
+
+/*
+ * A page of at most ?4 entries, newest first, from day ?1 (inclusive)
+ * back from before (?2, ?3), the (day, id) of the last row of the
+ * previous page. tempus is a view of the entries with their names.
+ */
+#define SQL_HISTORY \
+	"SELECT * FROM tempus WHERE day >= ?1 AND day <= ?2 AND " \
+	"(day < ?2 OR id < ?3) ORDER BY day DESC, id DESC LIMIT ?4"
+
+/*
+ * Entries added since the one with id ?, newest first. The + keeps it
+ * to the few rows after id, rather than walking the day index.
+ */
+#define SQL_HISTORY_SINCE \
+	"SELECT * FROM tempus WHERE id > ? ORDER BY +day DESC, id DESC"
+
+/*
+ * What the history snapshot is checked against (struct snapshot_key),
+ * as of the entry with id ?.
+ */
+#define SQL_SNAPSHOT_KEY \
+	"SELECT (SELECT nr FROM entry_changes), ifnull(max(id), 0), " \
+	"count(*) FROM entries WHERE id <= ?"
+
+/* The history list only fetches descriptions as they're wanted */
+#define SQL_DESCRIPTION	"SELECT description FROM entries WHERE id = ?"
+
+/*
+ * Entries matching an FTS5 query (?1, see db_fts_query()) within a day
+ * range (?2 & ?3, inclusive), best matches first, in the same column
+ * order as SQL_HISTORY. At most ?4 of them.
+ */
+#define SQL_SEARCH \
+	"SELECT tempus.* FROM entries_fts " \
+	"JOIN tempus ON tempus.id = entries_fts.rowid " \
+	"WHERE entries_fts MATCH ?1 AND tempus.day >= ?2 AND " \
+	"tempus.day <= ?3 ORDER BY rank LIMIT ?4"
+
+/* Join in the names of a table's entity/project/sub_project ids */
+#define SQL_NAMES_JOIN \
+	" JOIN entities e ON e.id = entity_id" \
+	" JOIN projects p ON p.id = project_id" \
+	" JOIN sub_projects s ON s.id = sub_project_id"
+
+/* The summaries table is maintained by triggers on entries */
+#define SQL_SUMMARIES \
+	"SELECT first_date, last_date, e.name, p.name, s.name, " \
+	"duration FROM summaries" SQL_NAMES_JOIN
+
+#define SQL_SUMMARIES_COUNT	"SELECT count(*) FROM summaries"
+
+/* Every combination of names used, how often and when last */
+#define SQL_COMPLETIONS \
+	"SELECT e.name, p.name, s.name, last_date, entries " \
+	"FROM summaries" SQL_NAMES_JOIN
+
+/* rollups.period */
+enum rollup_period {
+	ROLLUP_DAY = 0,
+	ROLLUP_WEEK,
+	ROLLUP_MONTH
+};
+
+/*
+ * The rollups whose bucket starts within the given (inclusive) range,
+ * in the same column order as SQL_SUMMARIES.
+ */
+#define SQL_ROLLUPS \
+	"SELECT bucket, CASE period WHEN 0 THEN bucket " \
+	"WHEN 1 THEN date(bucket, '+6 days') " \
+	"ELSE date(bucket, '+1 month', '-1 day') END, " \
+	"e.name, p.name, s.name, duration FROM rollups" SQL_NAMES_JOIN \
+	" WHERE period = ? AND bucket >= ? AND bucket <= ?"
+
+/* Like SQL_SUMMARIES, but for a date range using the daily rollups */
+#define SQL_RANGE_TOTALS \
+	"SELECT min(bucket), max(bucket), e.name, p.name, s.name, " \
+	"sum(duration) FROM rollups" SQL_NAMES_JOIN \
+	" WHERE period = 0 AND bucket >= ? AND bucket <= ? " \
+	"GROUP BY entity_id, project_id, sub_project_id"
+
+/*
+ * Total duration, optionally restricted to an entity, project and/or
+ * sub_project (?1 - ?3, NULL for any). SQL_RANGE_TOTAL additionally
+ * takes an inclusive date range (?4 & ?5).
+ */
+#define SQL_TOTAL_FILTER \
+	"(?1 IS NULL OR " \
+	"entity_id = (SELECT id FROM entities WHERE name = ?1)) AND " \
+	"(?2 IS NULL OR " \
+	"project_id = (SELECT id FROM projects WHERE name = ?2)) AND " \
+	"(?3 IS NULL OR " \
+	"sub_project_id = (SELECT id FROM sub_projects WHERE name = ?3))"
+
+#define SQL_TOTAL \
+	"SELECT ifnull(sum(duration), 0) FROM summaries WHERE " \
+	SQL_TOTAL_FILTER
+
+#define SQL_RANGE_TOTAL \
+	"SELECT ifnull(sum(duration), 0) FROM rollups WHERE period = 0 " \
+	"AND bucket >= ?4 AND bucket <= ?5 AND " SQL_TOTAL_FILTER
+
+/*
+ * Entries in an inclusive day range (?4 & ?5), optionally restricted to
+ * an entity, project and/or sub_project as for SQL_TOTAL, oldest first,
+ * in the same column order as SQL_HISTORY.
+ */
+#define SQL_EXPORT \
+	"SELECT t.id, date, e.name, p.name, s.name, duration, description, " \
+	"day FROM entries t" SQL_NAMES_JOIN " WHERE day >= ?4 AND " \
+	"day <= ?5 AND " SQL_TOTAL_FILTER " ORDER BY day, t.id"
+
+/*
+ * Adds whichever of the entity, project & sub_project names (?1 - ?3)
+ * don't already exist. This must be done before they can be used in
+ * SQL_INSERT or SQL_UPDATE.
+ */
+#define SQL_ADD_NAMES \
+	"INSERT INTO tempus_names (entity, project, sub_project) " \
+	"VALUES (?, ?, ?)"
+
+#define SQL_ENTITY_ID \
+	"(SELECT id FROM entities WHERE name = ifnull(?2, ''))"
+#define SQL_PROJECT_ID \
+	"(SELECT id FROM projects WHERE name = ifnull(?3, ''))"
+#define SQL_SUB_PROJECT_ID \
+	"(SELECT id FROM sub_projects WHERE name = ifnull(?4, ''))"
+
+/* ?1 date, ?2 - ?4 names, ?5 duration, ?6 description [, ?7 id] */
+#define SQL_INSERT \
+	"INSERT INTO entries " \
+	"(date, entity_id, project_id, sub_project_id, duration, " \
+	"description, day) VALUES (?1, " SQL_ENTITY_ID ", " SQL_PROJECT_ID \
+	", " SQL_SUB_PROJECT_ID ", ?5, ?6, " DATE_SQL_DAY("?1") ")"
+
+#define SQL_UPDATE \
+	"UPDATE entries SET date = ?1, entity_id = " SQL_ENTITY_ID ", " \
+	"project_id = " SQL_PROJECT_ID ", " \
+	"sub_project_id = " SQL_SUB_PROJECT_ID ", duration = ?5, " \
+	"description = ?6, day = " DATE_SQL_DAY("?1") " WHERE id = ?7"
+
+enum db_stmt {
+	DB_STMT_HISTORY = 0,
+	DB_STMT_ADD_NAMES,
+	DB_STMT_INSERT,
+	DB_STMT_UPDATE,
+	DB_STMT_SUMMARIES,
+	DB_STMT_SUMMARIES_COUNT,
+	DB_STMT_COMPLETIONS,
+	DB_STMT_ROLLUPS,
+	DB_STMT_RANGE_TOTALS,
+	DB_STMT_SEARCH,
+	DB_STMT_EXPORT,
+	DB_STMT_DESCRIPTION,
+	DB_STMT_HISTORY_SINCE,
+	DB_STMT_SNAPSHOT_KEY,
+
+	DB_STMT_MAX
+};
+
+typedef void (*db_work_fn)(void *data);
+
+extern void db_submit(db_work_fn work, GSourceFunc done, void *data);
+extern int db_open(const char *path, bool read_only);
+extern void db_close(void);
+extern sqlite3 *db_get(void);
+extern sqlite3_stmt *db_stmt(enum db_stmt which);
+extern int db_save_entry(gint64 *id, const char *date, const char *entity,
+			 const char *project, const char *sub_project,
+			 int duration, const char *description);
+extern char *db_fts_query(const char *text);
+
+#endif /* _DB_H_ */
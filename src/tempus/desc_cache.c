@@ -0,0 +1,95 @@
+/*
+ * desc_cache.c - Small cache of entry descriptions
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#include <stdbool.h>
+
+#include <glib.h>
+
+#include "desc_cache.h"
+
+/*
+ * The history list doesn't hold the descriptions, they're fetched by id
+ * when one is wanted (a tooltip or editing an entry) & the most recently
+ * used of them are kept here.
+ *
+ * Only to be used from the main thread.
+ */
+#define DESC_CACHE_SIZE		64
+
+struct desc {
+	gint64 id;
+	char *desc;
+};
+
+/* Of struct desc's, most recently used first */
+static GQueue lru = G_QUEUE_INIT;
+/* id -> its link in lru */
+static GHashTable *descs;
+
+static void free_desc(struct desc *d)
+{
+	g_free(d->desc);
+	g_slice_free(struct desc, d);
+}
+
+/*
+ * Look up the description of entry id. Returns false if it's not
+ * cached, otherwise desc is set to it (NULL for no description) until
+ * the cache is next changed.
+ */
+bool desc_cache_lookup(gint64 id, const char **desc)
+{
+	GList *link;
+
+	if (!descs)
+		return false;
+
+	link = g_hash_table_lookup(descs, &id);
+	if (!link)
+		return false;
+
+	g_queue_unlink(&lru, link);
+	g_queue_push_head_link(&lru, link);
+	*desc = ((struct desc *)link->data)->desc;
+
+	return true;
+}
+
+/* Add (or replace) the description of entry id, NULL for none */
+void desc_cache_insert(gint64 id, const char *desc)
+{
+	struct desc *d;
+	GList *link;
+
+	if (!descs)
+		descs = g_hash_table_new(g_int64_hash, g_int64_equal);
+
+	link = g_hash_table_lookup(descs, &id);
+	if (link) {
+		d = link->data;
+		g_free(d->desc);
+		d->desc = (desc && *desc) ? g_strdup(desc) : NULL;
+		g_queue_unlink(&lru, link);
+		g_queue_push_head_link(&lru, link);
+		return;
+	}
+
+	if (lru.length >= DESC_CACHE_SIZE) {
+		d = g_queue_pop_tail(&lru);
+		g_hash_table_remove(descs, &d->id);
+		free_desc(d);
+	}
+
+	d = g_slice_new(struct desc);
+	d->id = id;
+	d->desc = (desc && *desc) ? g_strdup(desc) : NULL;
+	g_queue_push_head(&lru, d);
+	/* The key lives in the struct desc */
+	g_hash_table_insert(descs, &d->id, lru.head);
+}
@@ -0,0 +1,20 @@
+/*
+ * desc_cache.h - Small cache of entry descriptions
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _DESC_CACHE_H_
+#define _DESC_CACHE_H_
+
+#include <stdbool.h>
+
+#include <glib.h>
+
+extern bool desc_cache_lookup(gint64 id, const char **desc);
+extern void desc_cache_insert(gint64 id, const char *desc);
+
+#endif /* _DESC_CACHE_H_ */
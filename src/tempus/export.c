@@ -0,0 +1,327 @@
+/*
+ * export.c - Export the entries as CSV, JSON Lines or iCalendar
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#define _POSIX_C_SOURCE	200809L		/* gmtime_r(3) */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sqlite3.h>
+
+#include "short_types.h"
+#include "db.h"
+#include "date.h"
+#include "util.h"
+#include "export.h"
+
+/*
+ * Rows are written out as they are stepped through, straight from the
+ * statement's column values, so exporting takes the same memory however
+ * many there are.
+ */
+#define EXPORT_BUF_SIZE		(64 * 1024)
+
+/* iCalendar lines are folded at this many octets */
+#define ICAL_LINE_MAX		75
+
+static const char * const format_names[EXPORT_FORMAT_MAX] = {
+	[EXPORT_CSV]	= "csv",
+	[EXPORT_JSONL]	= "jsonl",
+	[EXPORT_ICAL]	= "ical",
+};
+
+static const char * const format_exts[EXPORT_FORMAT_MAX] = {
+	[EXPORT_CSV]	= "csv",
+	[EXPORT_JSONL]	= "jsonl",
+	[EXPORT_ICAL]	= "ics",
+};
+
+struct export_row {
+	sqlite3_int64 id;
+	const char *date;
+	const char *entity;
+	const char *project;
+	const char *sub_project;
+	const char *description;
+	int duration;
+	int day;
+};
+
+/* An empty name or description is NULL in some older entries */
+static const char *col_text(sqlite3_stmt *stmt, int col)
+{
+	const char *text = (const char *)sqlite3_column_text(stmt, col);
+
+	return text ? text : "";
+}
+
+/* RFC 4180, only quoted when it has to be */
+static void csv_field(FILE *fp, const char *str, bool last)
+{
+	if (strpbrk(str, ",\"\r\n")) {
+		putc('"', fp);
+		for (; *str; str++) {
+			if (*str == '"')
+				putc('"', fp);
+			putc(*str, fp);
+		}
+		putc('"', fp);
+	} else {
+		fputs(str, fp);
+	}
+
+	fputs(last ? "\r\n" : ",", fp);
+}
+
+static void csv_row(FILE *fp, const struct export_row *row)
+{
+	fprintf(fp, "%lld,", (long long)row->id);
+	csv_field(fp, row->date, false);
+	csv_field(fp, row->entity, false);
+	csv_field(fp, row->project, false);
+	csv_field(fp, row->sub_project, false);
+	fprintf(fp, "%d,", row->duration);
+	csv_field(fp, row->description, true);
+}
+
+static void json_string(FILE *fp, const char *key, const char *str)
+{
+	fprintf(fp, ",\"%s\":\"", key);
+	for (; *str; str++) {
+		unsigned char c = *str;
+
+		switch (c) {
+		case '"':
+			fputs("\\\"", fp);
+			break;
+		case '\\':
+			fputs("\\\\", fp);
+			break;
+		case '\n':
+			fputs("\\n", fp);
+			break;
+		case '\r':
+			fputs("\\r", fp);
+			break;
+		case '\t':
+			fputs("\\t", fp);
+			break;
+		default:
+			if (c < 0x20)
+				fprintf(fp, "\\u%04x", c);
+			else
+				putc(c, fp);
+		}
+	}
+	putc('"', fp);
+}
+
+static void jsonl_row(FILE *fp, const struct export_row *row)
+{
+	fprintf(fp, "{\"id\":%lld", (long long)row->id);
+	json_string(fp, "date", row->date);
+	json_string(fp, "entity", row->entity);
+	json_string(fp, "project", row->project);
+	json_string(fp, "sub_project", row->sub_project);
+	fprintf(fp, ",\"duration\":%d", row->duration);
+	json_string(fp, "description", row->description);
+	fputs("}\n", fp);
+}
+
+/*
+ * Write str as part of a content line, folding it so no line is longer
+ * than ICAL_LINE_MAX octets (without splitting a UTF-8 character) and
+ * optionally escaping it as TEXT. *len is the length of the line so far.
+ */
+static void ical_put(FILE *fp, const char *str, int *len, bool escape)
+{
+	while (*str) {
+		char esc[2] = "\\";
+		const char *c = str;
+		int clen = 1;
+
+		if (escape && strchr("\\;,", *str)) {
+			esc[1] = *str;
+			c = esc;
+			clen = 2;
+		} else if (escape && *str == '\n') {
+			c = "\\n";
+			clen = 2;
+		} else if (escape && *str == '\r') {
+			str++;
+			continue;
+		} else {
+			while ((str[clen] & 0xc0) == 0x80)
+				clen++;
+		}
+
+		if (*len + clen > ICAL_LINE_MAX) {
+			fputs("\r\n ", fp);
+			*len = 1;
+		}
+		fwrite(c, 1, clen, fp);
+		*len += clen;
+
+		str += c == str ? clen : 1;
+	}
+}
+
+static void ical_line(FILE *fp, const char *name, const char *value,
+		      bool escape)
+{
+	int len = 0;
+
+	ical_put(fp, name, &len, false);
+	ical_put(fp, ":", &len, false);
+	ical_put(fp, value, &len, escape);
+	fputs("\r\n", fp);
+}
+
+/*
+ * Entries only have a date, so they're all day events with the time
+ * spent in the summary, and in seconds in X-TEMPUS-DURATION. (DURATION
+ * can only be whole days for an event starting on a date.)
+ */
+static void ical_row(FILE *fp, const struct export_row *row,
+		     const char *dtstamp)
+{
+	char buf[64];
+	char *summary;
+
+	ical_line(fp, "BEGIN", "VEVENT", false);
+	snprintf(buf, sizeof(buf), "%lld@tempus", (long long)row->id);
+	ical_line(fp, "UID", buf, false);
+	ical_line(fp, "DTSTAMP", dtstamp, false);
+	date_from_day(row->day, buf, sizeof(buf));
+	/* YYYY-MM-DD -> YYYYMMDD */
+	memmove(buf + 4, buf + 5, 2);
+	memmove(buf + 6, buf + 8, 3);
+	ical_line(fp, "DTSTART;VALUE=DATE", buf, false);
+	secs_to_dur(row->duration, buf, sizeof(buf), "%u:%02u:%02u");
+	summary = sqlite3_mprintf("%s %s / %s / %s", buf, row->entity,
+				  row->project, row->sub_project);
+	ical_line(fp, "SUMMARY", summary, true);
+	sqlite3_free(summary);
+	if (*row->description)
+		ical_line(fp, "DESCRIPTION", row->description, true);
+	ical_line(fp, "TRANSP", "TRANSPARENT", false);
+	snprintf(buf, sizeof(buf), "%d", row->duration);
+	ical_line(fp, "X-TEMPUS-DURATION", buf, false);
+	ical_line(fp, "END", "VEVENT", false);
+}
+
+static void ical_begin(FILE *fp)
+{
+	ical_line(fp, "BEGIN", "VCALENDAR", false);
+	ical_line(fp, "VERSION", "2.0", false);
+	ical_line(fp, "PRODID", "-//tempus//tempus//EN", false);
+}
+
+/* Returns the format for a name as given to tempus export, -1 if none */
+int export_format_from_name(const char *name)
+{
+	int i;
+
+	for (i = 0; i < EXPORT_FORMAT_MAX; i++) {
+		if (strcmp(name, format_names[i]) == 0 ||
+		    strcmp(name, format_exts[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/* The usual file name extension for a format */
+const char *export_format_ext(enum export_format format)
+{
+	return format_exts[format];
+}
+
+/*
+ * Export the entries matching filter, oldest first, to fp using stmt, a
+ * prepared SQL_EXPORT.
+ *
+ * fp is given a large buffer, so mustn't have been used yet. It's
+ * flushed, but not closed, afterwards.
+ *
+ * Returns the number of entries exported or -1 on error.
+ */
+s64 export_entries(sqlite3_stmt *stmt, const struct export_filter *filter,
+		   enum export_format format, FILE *fp)
+{
+	struct export_row row;
+	char dtstamp[32];
+	s64 nr_rows = 0;
+	int rc;
+
+	setvbuf(fp, NULL, _IOFBF, EXPORT_BUF_SIZE);
+
+	sqlite3_bind_text(stmt, 1, filter->entity, -1, NULL);
+	sqlite3_bind_text(stmt, 2, filter->project, -1, NULL);
+	sqlite3_bind_text(stmt, 3, filter->sub_project, -1, NULL);
+	sqlite3_bind_int(stmt, 4, filter->from);
+	sqlite3_bind_int(stmt, 5, filter->to);
+
+	if (format == EXPORT_CSV) {
+		fputs("id,date,entity,project,sub_project,duration,"
+		      "description\r\n", fp);
+	} else if (format == EXPORT_ICAL) {
+		time_t now = time(NULL);
+		struct tm tm;
+
+		gmtime_r(&now, &tm);
+		strftime(dtstamp, sizeof(dtstamp), "%Y%m%dT%H%M%SZ", &tm);
+		ical_begin(fp);
+	}
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		row.id = sqlite3_column_int64(stmt, SQL_COL_ID);
+		row.date = col_text(stmt, SQL_COL_DATE);
+		row.entity = col_text(stmt, SQL_COL_ENTITY);
+		row.project = col_text(stmt, SQL_COL_PROJECT);
+		row.sub_project = col_text(stmt, SQL_COL_SUB_PROJECT);
+		row.description = col_text(stmt, SQL_COL_DESCRIPTION);
+		row.duration = sqlite3_column_int(stmt, SQL_COL_DURATION);
+		row.day = sqlite3_column_int(stmt, SQL_COL_DAY);
+
+		switch (format) {
+		case EXPORT_CSV:
+			csv_row(fp, &row);
+			break;
+		case EXPORT_JSONL:
+			jsonl_row(fp, &row);
+			break;
+		case EXPORT_ICAL:
+			ical_row(fp, &row, dtstamp);
+			break;
+		case EXPORT_FORMAT_MAX:
+			break;
+		}
+		nr_rows++;
+	}
+	sqlite3_reset(stmt);
+	if (rc != SQLITE_DONE) {
+		fprintf(stderr, "Export failed: %s\n",
+			sqlite3_errmsg(sqlite3_db_handle(stmt)));
+		return -1;
+	}
+
+	if (format == EXPORT_ICAL)
+		ical_line(fp, "END", "VCALENDAR", false);
+
+	if (fflush(fp) == EOF || ferror(fp)) {
+		fprintf(stderr, "Cannot write export: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return nr_rows;
+}
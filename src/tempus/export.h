@@ -0,0 +1,42 @@
+/*
+ * export.h - Export the entries as CSV, JSON Lines or iCalendar
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _EXPORT_H_
+#define _EXPORT_H_
+
+#include <stdio.h>
+
+#include <sqlite3.h>
+
+#include "short_types.h"
+
+enum export_format {
+	EXPORT_CSV = 0,
+	EXPORT_JSONL,
+	EXPORT_ICAL,
+
+	EXPORT_FORMAT_MAX
+};
+
+/* Days are inclusive, NULL names match anything */
+struct export_filter {
+	int from;
+	int to;
+	const char *entity;
+	const char *project;
+	const char *sub_project;
+};
+
+extern int export_format_from_name(const char *name);
+extern const char *export_format_ext(enum export_format format);
+extern s64 export_entries(sqlite3_stmt *stmt,
+			  const struct export_filter *filter,
+			  enum export_format format, FILE *fp);
+
+#endif /* _EXPORT_H_ */
@@ -0,0 +1,454 @@
+/*
+ * journal.c - Crash safe journal of the recording in progress
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#define _GNU_SOURCE			/* O_CLOEXEC, fdatasync(2) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "short_types.h"
+#include "journal.h"
+
+/*
+ * The journal is a text file of one record per line, starting with a
+ * snapshot of the whole recording, followed by whatever has changed
+ * since, e.g
+ *
+ *	tempus-journal 1
+ *	R <id> <day>			entry id (-1 for new) & day number
+ *	N <0|1|2> <name>		entity, project or sub_project
+ *	D <description>
+ *	I <offset> <text>		description text inserted
+ *	X <offset> <nr_chars>		description text deleted
+ *	S <time> <elapsed>		started
+ *	T <time>			still running
+ *	P <elapsed>			stopped
+ *
+ * where times are the wall clock in us (the monotonic clock doesn't
+ * survive a reboot) and strings are escaped with g_strescape().
+ *
+ * Reading it back, a last line without a newline (torn by a crash) is
+ * ignored.
+ */
+#define JOURNAL_MAGIC		"tempus-journal 1"
+
+/* The most we'll go without syncing the journal to disk */
+#define JOURNAL_SYNC_SECS	30
+/* How often a running recording is checkpointed */
+#define JOURNAL_CHECKPOINT_SECS	60
+
+static int journal_fd = -1;
+static char *journal_path;
+static guint checkpoint_id;
+static bool running;
+static bool dirty;
+static gint64 last_sync;
+
+static void sync_journal(void)
+{
+	fdatasync(journal_fd);
+	last_sync = g_get_monotonic_time();
+	dirty = false;
+}
+
+/*
+ * Append a record, syncing it to disk if asked, or if it's been a while
+ * since the last sync. On error the journal is given up on.
+ */
+static void journal_write(const char *rec, size_t len, bool sync)
+{
+	if (journal_fd == -1)
+		return;
+
+	while (len > 0) {
+		ssize_t bytes = write(journal_fd, rec, len);
+
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Cannot write to journal %s: %s\n",
+				journal_path, strerror(errno));
+			close(journal_fd);
+			journal_fd = -1;
+			return;
+		}
+		rec += bytes;
+		len -= bytes;
+	}
+
+	dirty = true;
+	if (sync || g_get_monotonic_time() - last_sync >=
+		    JOURNAL_SYNC_SECS * G_USEC_PER_SEC)
+		sync_journal();
+}
+
+static void journal_printf(bool sync, const char *fmt, ...)
+{
+	va_list ap;
+	char *rec;
+
+	if (journal_fd == -1)
+		return;
+
+	va_start(ap, fmt);
+	rec = g_strdup_vprintf(fmt, ap);
+	va_end(ap);
+
+	journal_write(rec, strlen(rec), sync);
+	g_free(rec);
+}
+
+static gboolean checkpoint(gpointer data __attribute__((unused)))
+{
+	journal_printf(true, "T %" G_GINT64_FORMAT "\n", g_get_real_time());
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void set_running(bool is_running)
+{
+	running = is_running;
+
+	if (running && !checkpoint_id) {
+		checkpoint_id = g_timeout_add_seconds(JOURNAL_CHECKPOINT_SECS,
+						      checkpoint, NULL);
+	} else if (!running && checkpoint_id) {
+		g_source_remove(checkpoint_id);
+		checkpoint_id = 0;
+	}
+}
+
+static void append_str(GString *rec, const char *str)
+{
+	char *esc = g_strescape(str ? str : "", NULL);
+
+	g_string_append(rec, esc);
+	g_free(esc);
+}
+
+/* Make a rename into or out of path's directory stick */
+static void sync_dir(const char *path)
+{
+	char *dir = g_path_get_dirname(path);
+	int fd;
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1 || fsync(fd) == -1)
+		fprintf(stderr, "Cannot sync directory %s: %s\n", dir,
+			strerror(errno));
+	if (fd != -1)
+		close(fd);
+	g_free(dir);
+}
+
+/*
+ * Start a new journal at path with a snapshot of state, replacing any
+ * existing one.
+ *
+ * The snapshot is written to a temporary file which is then renamed
+ * over path, so there's always a complete journal on disk. The directory
+ * is synced after, otherwise a power cut could still lose the rename.
+ */
+int journal_open(const char *path, const struct journal_state *state)
+{
+	GString *rec = g_string_new(JOURNAL_MAGIC "\n");
+	char *tmp = g_strconcat(path, ".tmp", NULL);
+	int err = -1;
+	int i;
+
+	journal_close(false);
+
+	g_string_append_printf(rec, "R %" G_GINT64_FORMAT " %d\n", state->id,
+			       state->day);
+	for (i = 0; i < JOURNAL_NAME_MAX; i++) {
+		g_string_append_printf(rec, "N %d ", i);
+		append_str(rec, state->names[i]);
+		g_string_append_c(rec, '\n');
+	}
+	g_string_append(rec, "D ");
+	append_str(rec, state->description ? state->description->str : "");
+	g_string_append_c(rec, '\n');
+	if (state->running)
+		g_string_append_printf(rec, "S %" G_GINT64_FORMAT " %u\n",
+				       g_get_real_time(), state->elapsed);
+	else
+		g_string_append_printf(rec, "P %u\n", state->elapsed);
+
+	journal_fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND |
+			  O_CLOEXEC, 0600);
+	if (journal_fd == -1) {
+		fprintf(stderr, "Cannot create journal %s: %s\n", tmp,
+			strerror(errno));
+		goto out_free;
+	}
+
+	journal_path = g_strdup(path);
+	journal_write(rec->str, rec->len, true);
+	if (journal_fd == -1)
+		goto out_unlink;
+
+	if (rename(tmp, path) == -1) {
+		fprintf(stderr, "Cannot rename journal %s: %s\n", tmp,
+			strerror(errno));
+		close(journal_fd);
+		journal_fd = -1;
+		goto out_unlink;
+	}
+	sync_dir(path);
+
+	set_running(state->running);
+	err = 0;
+	goto out_free;
+
+out_unlink:
+	unlink(tmp);
+	g_free(journal_path);
+	journal_path = NULL;
+out_free:
+	g_string_free(rec, true);
+	g_free(tmp);
+
+	return err;
+}
+
+void journal_set_name(enum journal_name which, const char *name)
+{
+	GString *rec;
+
+	if (journal_fd == -1)
+		return;
+
+	rec = g_string_new(NULL);
+	g_string_printf(rec, "N %d ", which);
+	append_str(rec, name);
+	g_string_append_c(rec, '\n');
+	journal_write(rec->str, rec->len, false);
+	g_string_free(rec, true);
+}
+
+/* len bytes of text were inserted into the description at offset chars */
+void journal_insert(int offset, const char *text, int len)
+{
+	GString *rec;
+	char *str;
+
+	if (journal_fd == -1)
+		return;
+
+	str = g_strndup(text, len);
+	rec = g_string_new(NULL);
+	g_string_printf(rec, "I %d ", offset);
+	append_str(rec, str);
+	g_string_append_c(rec, '\n');
+	journal_write(rec->str, rec->len, false);
+	g_string_free(rec, true);
+	g_free(str);
+}
+
+void journal_delete(int offset, int nr_chars)
+{
+	journal_printf(false, "X %d %d\n", offset, nr_chars);
+}
+
+void journal_start(u32 elapsed)
+{
+	journal_printf(true, "S %" G_GINT64_FORMAT " %u\n", g_get_real_time(),
+		       elapsed);
+	set_running(journal_fd != -1);
+}
+
+void journal_stop(u32 elapsed)
+{
+	journal_printf(true, "P %u\n", elapsed);
+	set_running(false);
+}
+
+/*
+ * Close the journal, removing it if discard is true (the recording has
+ * been saved or thrown away). Otherwise it's left for journal_read().
+ */
+void journal_close(bool discard)
+{
+	if (journal_fd != -1) {
+		if (running && !discard)
+			checkpoint(NULL);
+		else if (dirty && !discard)
+			sync_journal();
+		close(journal_fd);
+		journal_fd = -1;
+	}
+	set_running(false);
+
+	if (journal_path && discard)
+		unlink(journal_path);
+	g_free(journal_path);
+	journal_path = NULL;
+}
+
+bool journal_is_open(void)
+{
+	return journal_fd != -1;
+}
+
+/* Offsets are in chars, clamped to the description */
+static char *desc_ptr(GString *desc, int offset)
+{
+	glong len = g_utf8_strlen(desc->str, desc->len);
+
+	if (offset < 0)
+		offset = 0;
+	else if (offset > len)
+		offset = len;
+
+	return g_utf8_offset_to_pointer(desc->str, offset);
+}
+
+static void set_str(char **str, const char *esc)
+{
+	g_free(*str);
+	*str = g_strcompress(esc);
+}
+
+/*
+ * Replay the journal at path into state, the recording as of the last
+ * record. A recording that was still running when the journal ends is
+ * counted up to its last checkpoint.
+ *
+ * Returns 0 if there was a journal, -1 if not. Either way state is
+ * then to be cleared with journal_state_clear().
+ */
+int journal_read(const char *path, struct journal_state *state)
+{
+	char *contents;
+	char **lines;
+	gint64 started = 0;
+	gint64 last_seen = 0;
+	u32 start_elapsed = 0;
+	int nr_lines;
+	int i;
+
+	memset(state, 0, sizeof(struct journal_state));
+	state->id = -1;
+	state->description = g_string_new(NULL);
+
+	if (!g_file_get_contents(path, &contents, NULL, NULL))
+		return -1;
+
+	lines = g_strsplit(contents, "\n", -1);
+	g_free(contents);
+	if (!lines[0] || strcmp(lines[0], JOURNAL_MAGIC) != 0) {
+		fprintf(stderr, "Ignoring unrecognised journal %s\n", path);
+		g_strfreev(lines);
+		return -1;
+	}
+
+	/* The last "line" is whatever followed the last newline */
+	nr_lines = g_strv_length(lines) - 1;
+	for (i = 1; i < nr_lines; i++) {
+		const char *line = lines[i];
+		const char *arg;
+		gint64 t;
+		int n;
+		int x;
+		u32 e;
+
+		if (!*line || line[1] != ' ')
+			continue;
+
+		switch (*line) {
+		case 'R':
+			sscanf(line + 2, "%" G_GINT64_FORMAT " %d", &state->id,
+			       &state->day);
+			break;
+		case 'N':
+			arg = strchr(line + 2, ' ');
+			n = atoi(line + 2);
+			if (arg && n >= 0 && n < JOURNAL_NAME_MAX)
+				set_str(&state->names[n], arg + 1);
+			break;
+		case 'D':
+			arg = line + 2;
+			contents = g_strcompress(arg);
+			g_string_assign(state->description, contents);
+			g_free(contents);
+			break;
+		case 'I':
+			arg = strchr(line + 2, ' ');
+			if (!arg)
+				break;
+			contents = g_strcompress(arg + 1);
+			g_string_insert(state->description,
+					desc_ptr(state->description,
+						 atoi(line + 2)) -
+					state->description->str, contents);
+			g_free(contents);
+			break;
+		case 'X':
+			if (sscanf(line + 2, "%d %d", &n, &x) != 2 || x < 0)
+				break;
+			arg = desc_ptr(state->description, n);
+			g_string_erase(state->description,
+				       arg - state->description->str,
+				       desc_ptr(state->description, n + x) - arg);
+			break;
+		case 'S':
+			if (sscanf(line + 2, "%" G_GINT64_FORMAT " %u", &t,
+				   &e) != 2)
+				break;
+			state->running = true;
+			state->elapsed = start_elapsed = e;
+			started = last_seen = t;
+			break;
+		case 'T':
+			if (!state->running ||
+			    sscanf(line + 2, "%" G_GINT64_FORMAT, &t) != 1)
+				break;
+			if (t > last_seen)
+				last_seen = t;
+			state->elapsed = start_elapsed +
+				(last_seen - started) / G_USEC_PER_SEC;
+			break;
+		case 'P':
+			if (sscanf(line + 2, "%u", &e) != 1)
+				break;
+			state->running = false;
+			state->elapsed = e;
+			break;
+		}
+	}
+	g_strfreev(lines);
+
+	for (i = 0; i < JOURNAL_NAME_MAX; i++) {
+		if (!state->names[i])
+			state->names[i] = g_strdup("");
+	}
+
+	return 0;
+}
+
+void journal_state_clear(struct journal_state *state)
+{
+	int i;
+
+	for (i = 0; i < JOURNAL_NAME_MAX; i++) {
+		g_free(state->names[i]);
+		state->names[i] = NULL;
+	}
+	if (state->description)
+		g_string_free(state->description, true);
+	state->description = NULL;
+}
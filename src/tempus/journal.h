@@ -0,0 +1,48 @@
+/*
+ * journal.h - Crash safe journal of the recording in progress
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdbool.h>
+
+#include <glib.h>
+
+#include "short_types.h"
+
+enum journal_name {
+	JOURNAL_ENTITY = 0,
+	JOURNAL_PROJECT,
+	JOURNAL_SUB_PROJECT,
+
+	JOURNAL_NAME_MAX
+};
+
+struct journal_state {
+	gint64 id;		/* Of the entry being edited, -1 for new */
+	int day;		/* Day number it was recorded on */
+	u32 elapsed;		/* As of the last record */
+	bool running;
+	char *names[JOURNAL_NAME_MAX];
+	GString *description;
+};
+
+extern int journal_open(const char *path, const struct journal_state *state);
+extern void journal_set_name(enum journal_name which, const char *name);
+extern void journal_insert(int offset, const char *text, int len);
+extern void journal_delete(int offset, int nr_chars);
+extern void journal_start(u32 elapsed);
+extern void journal_stop(u32 elapsed);
+extern void journal_close(bool discard);
+extern bool journal_is_open(void);
+
+extern int journal_read(const char *path, struct journal_state *state);
+extern void journal_state_clear(struct journal_state *state);
+
+#endif /* _JOURNAL_H_ */
@@ -0,0 +1,597 @@
+/*
+ * schema.c - Database schema versioning & migrations
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <sqlite3.h>
+
+#include "date.h"
+#include "schema.h"
+
+#define SUMMARIES_OLD_GROUP \
+	"entity = ifnull(OLD.entity, '') AND " \
+	"project = ifnull(OLD.project, '') AND " \
+	"sub_project = ifnull(OLD.sub_project, '')"
+
+#define TEMPUS_OLD_GROUP \
+	"entity = OLD.entity COLLATE NOCASE AND " \
+	"project = OLD.project COLLATE NOCASE AND " \
+	"sub_project = OLD.sub_project COLLATE NOCASE"
+
+#define SUMMARIES_ADD_NEW \
+	"INSERT INTO summaries VALUES (ifnull(NEW.entity, ''), " \
+	"ifnull(NEW.project, ''), ifnull(NEW.sub_project, ''), " \
+	"NEW.date, NEW.date, NEW.duration, 1) " \
+	"ON CONFLICT (entity, project, sub_project) DO UPDATE SET " \
+	"first_date = min(first_date, excluded.first_date), " \
+	"last_date = max(last_date, excluded.last_date), " \
+	"duration = duration + excluded.duration, " \
+	"entries = entries + 1;"
+
+#define SUMMARIES_REMOVE_OLD \
+	"UPDATE summaries SET " \
+	"duration = duration - OLD.duration, entries = entries - 1, " \
+	"first_date = (SELECT min(date) FROM tempus WHERE " \
+	TEMPUS_OLD_GROUP "), " \
+	"last_date = (SELECT max(date) FROM tempus WHERE " \
+	TEMPUS_OLD_GROUP ") " \
+	"WHERE " SUMMARIES_OLD_GROUP ";" \
+	"DELETE FROM summaries WHERE entries = 0 AND " \
+	SUMMARIES_OLD_GROUP ";"
+
+#define ROLLUP_DAY_BUCKET(d)	d
+#define ROLLUP_WEEK_BUCKET(d)	"date(" d ", 'weekday 0', '-6 days')"
+#define ROLLUP_MONTH_BUCKET(d)	"date(" d ", 'start of month')"
+
+#define ROLLUPS_POPULATE(period, bucket) \
+	"INSERT INTO rollups SELECT " period ", " bucket " AS b, " \
+	"ifnull(entity, ''), ifnull(project, ''), ifnull(sub_project, ''), " \
+	"sum(duration), count(*) FROM tempus GROUP BY b, " \
+	"entity COLLATE NOCASE, project COLLATE NOCASE, " \
+	"sub_project COLLATE NOCASE;"
+
+#define ROLLUP_ADD(period, bucket) \
+	"INSERT INTO rollups VALUES (" period ", " bucket ", " \
+	"ifnull(NEW.entity, ''), ifnull(NEW.project, ''), " \
+	"ifnull(NEW.sub_project, ''), NEW.duration, 1) " \
+	"ON CONFLICT (period, bucket, entity, project, sub_project) " \
+	"DO UPDATE SET duration = duration + excluded.duration, " \
+	"entries = entries + 1;"
+
+#define ROLLUP_REMOVE(period, bucket) \
+	"UPDATE rollups SET duration = duration - OLD.duration, " \
+	"entries = entries - 1 WHERE period = " period " AND " \
+	"bucket = " bucket " AND " SUMMARIES_OLD_GROUP ";" \
+	"DELETE FROM rollups WHERE entries = 0 AND period = " period " AND " \
+	"bucket = " bucket " AND " SUMMARIES_OLD_GROUP ";"
+
+#define ROLLUPS_ADD_NEW \
+	ROLLUP_ADD("0", ROLLUP_DAY_BUCKET("NEW.date")) \
+	ROLLUP_ADD("1", ROLLUP_WEEK_BUCKET("NEW.date")) \
+	ROLLUP_ADD("2", ROLLUP_MONTH_BUCKET("NEW.date"))
+
+#define ROLLUPS_REMOVE_OLD \
+	ROLLUP_REMOVE("0", ROLLUP_DAY_BUCKET("OLD.date")) \
+	ROLLUP_REMOVE("1", ROLLUP_WEEK_BUCKET("OLD.date")) \
+	ROLLUP_REMOVE("2", ROLLUP_MONTH_BUCKET("OLD.date"))
+
+/*
+ * From version 5 the names live in their own tables and entries,
+ * summaries & rollups refer to them by id.
+ */
+#define DIMENSION_TABLE(name) \
+	"CREATE TABLE " name " (id INTEGER PRIMARY KEY, " \
+	"name TEXT NOT NULL UNIQUE COLLATE NOCASE);"
+
+#define ENTRIES_OLD_GROUP \
+	"entity_id = OLD.entity_id AND project_id = OLD.project_id AND " \
+	"sub_project_id = OLD.sub_project_id"
+
+#define ENTRIES_SUMMARIES_ADD_NEW \
+	"INSERT INTO summaries VALUES (NEW.entity_id, NEW.project_id, " \
+	"NEW.sub_project_id, NEW.date, NEW.date, NEW.duration, 1) " \
+	"ON CONFLICT (entity_id, project_id, sub_project_id) DO UPDATE SET " \
+	"first_date = min(first_date, excluded.first_date), " \
+	"last_date = max(last_date, excluded.last_date), " \
+	"duration = duration + excluded.duration, " \
+	"entries = entries + 1;"
+
+#define ENTRIES_SUMMARIES_REMOVE_OLD \
+	"UPDATE summaries SET " \
+	"duration = duration - OLD.duration, entries = entries - 1, " \
+	"first_date = (SELECT min(date) FROM entries WHERE " \
+	ENTRIES_OLD_GROUP "), " \
+	"last_date = (SELECT max(date) FROM entries WHERE " \
+	ENTRIES_OLD_GROUP ") " \
+	"WHERE " ENTRIES_OLD_GROUP ";" \
+	"DELETE FROM summaries WHERE entries = 0 AND " \
+	ENTRIES_OLD_GROUP ";"
+
+#define ENTRIES_ROLLUPS_POPULATE(period, bucket) \
+	"INSERT INTO rollups SELECT " period ", " bucket " AS b, " \
+	"entity_id, project_id, sub_project_id, sum(duration), count(*) " \
+	"FROM entries GROUP BY b, entity_id, project_id, sub_project_id;"
+
+#define ENTRIES_ROLLUP_ADD(period, bucket) \
+	"INSERT INTO rollups VALUES (" period ", " bucket ", " \
+	"NEW.entity_id, NEW.project_id, NEW.sub_project_id, " \
+	"NEW.duration, 1) " \
+	"ON CONFLICT (period, bucket, entity_id, project_id, " \
+	"sub_project_id) DO UPDATE SET " \
+	"duration = duration + excluded.duration, " \
+	"entries = entries + 1;"
+
+#define ENTRIES_ROLLUP_REMOVE(period, bucket) \
+	"UPDATE rollups SET duration = duration - OLD.duration, " \
+	"entries = entries - 1 WHERE period = " period " AND " \
+	"bucket = " bucket " AND " ENTRIES_OLD_GROUP ";" \
+	"DELETE FROM rollups WHERE entries = 0 AND period = " period " AND " \
+	"bucket = " bucket " AND " ENTRIES_OLD_GROUP ";"
+
+#define ENTRIES_ROLLUPS_ADD_NEW \
+	ENTRIES_ROLLUP_ADD("0", ROLLUP_DAY_BUCKET("NEW.date")) \
+	ENTRIES_ROLLUP_ADD("1", ROLLUP_WEEK_BUCKET("NEW.date")) \
+	ENTRIES_ROLLUP_ADD("2", ROLLUP_MONTH_BUCKET("NEW.date"))
+
+#define ENTRIES_ROLLUPS_REMOVE_OLD \
+	ENTRIES_ROLLUP_REMOVE("0", ROLLUP_DAY_BUCKET("OLD.date")) \
+	ENTRIES_ROLLUP_REMOVE("1", ROLLUP_WEEK_BUCKET("OLD.date")) \
+	ENTRIES_ROLLUP_REMOVE("2", ROLLUP_MONTH_BUCKET("OLD.date"))
+
+#define ENTRIES_NAMES(row) \
+	"(SELECT name FROM entities WHERE id = " row ".entity_id), " \
+	"(SELECT name FROM projects WHERE id = " row ".project_id), " \
+	"(SELECT name FROM sub_projects WHERE id = " row ".sub_project_id)"
+
+#define ENTRIES_FTS_ADD_NEW \
+	"INSERT INTO entries_fts (rowid, description, entity, project, " \
+	"sub_project) VALUES (NEW.id, NEW.description, " \
+	ENTRIES_NAMES("NEW") ");"
+
+/* An external content table needs telling exactly what it had */
+#define ENTRIES_FTS_REMOVE_OLD \
+	"INSERT INTO entries_fts (entries_fts, rowid, description, entity, " \
+	"project, sub_project) VALUES ('delete', OLD.id, OLD.description, " \
+	ENTRIES_NAMES("OLD") ");"
+
+/*
+ * Renaming an entity, project or sub_project changes the names of all
+ * its entries, which the index has to be told about entry by entry, with
+ * the old name given in place of the one now in the table.
+ */
+#define NAME_FTS_RENAME(table, id_col, entity, project, sub_project) \
+	"CREATE TRIGGER " table "_fts_au AFTER UPDATE OF name ON " table " " \
+	"BEGIN " \
+	"INSERT INTO entries_fts (entries_fts, rowid, description, entity, " \
+	"project, sub_project) SELECT 'delete', id, description, " \
+	entity ", " project ", " sub_project " FROM tempus WHERE id IN " \
+	"(SELECT id FROM entries WHERE " id_col " = OLD.id);" \
+	"INSERT INTO entries_fts (rowid, description, entity, project, " \
+	"sub_project) SELECT id, description, entity, project, sub_project " \
+	"FROM tempus WHERE id IN " \
+	"(SELECT id FROM entries WHERE " id_col " = NEW.id);" \
+	"END;"
+
+/*
+ * The schema version is stored in the databases user_version. Each entry
+ * here upgrades the schema from version n to n + 1, i.e migrations[0]
+ * takes a new (or pre-versioning) database to version 1.
+ *
+ * Only ever append to this list.
+ */
+static const char * const migrations[] = {
+	/* 1: The original schema */
+	"CREATE TABLE IF NOT EXISTS tempus (id INTEGER PRIMARY KEY, "
+	"date TEXT, entity TEXT, project TEXT, sub_project TEXT, "
+	"duration INT, description TEXT)",
+
+	/*
+	 * 2: Indexes for the date ordered history and the case insensitive
+	 *    grouping done by the summaries. The latter covers the columns
+	 *    its query uses, the history still reads each row from the
+	 *    table, it wants the description too.
+	 */
+	"DROP INDEX IF EXISTS tempus_date_idx;"
+	"CREATE INDEX tempus_history_idx ON tempus "
+	"(date, entity, project, sub_project, duration);"
+	"CREATE INDEX tempus_summaries_idx ON tempus "
+	"(entity COLLATE NOCASE, project COLLATE NOCASE, "
+	"sub_project COLLATE NOCASE, date, duration)",
+
+	/*
+	 * 3: Per entity/project/sub_project totals, kept up to date by
+	 *    triggers so the summaries don't need to aggregate the whole
+	 *    of tempus. An UPDATE is handled as removing the old row from
+	 *    its group and adding the new one.
+	 *
+	 *    first/last_date can't be wound back on removal so they are
+	 *    recomputed for the affected group via tempus_summaries_idx.
+	 */
+	"CREATE TABLE summaries ("
+	"entity TEXT COLLATE NOCASE, project TEXT COLLATE NOCASE, "
+	"sub_project TEXT COLLATE NOCASE, first_date TEXT, last_date TEXT, "
+	"duration INT, entries INT, "
+	"PRIMARY KEY (entity, project, sub_project)) WITHOUT ROWID;"
+
+	"INSERT INTO summaries SELECT ifnull(entity, ''), "
+	"ifnull(project, ''), ifnull(sub_project, ''), min(date), max(date), "
+	"sum(duration), count(*) FROM tempus GROUP BY "
+	"entity COLLATE NOCASE, project COLLATE NOCASE, "
+	"sub_project COLLATE NOCASE;"
+
+	"CREATE TRIGGER tempus_summaries_ai AFTER INSERT ON tempus BEGIN "
+	SUMMARIES_ADD_NEW
+	"END;"
+
+	"CREATE TRIGGER tempus_summaries_ad AFTER DELETE ON tempus BEGIN "
+	SUMMARIES_REMOVE_OLD
+	"END;"
+
+	"CREATE TRIGGER tempus_summaries_au AFTER UPDATE ON tempus BEGIN "
+	SUMMARIES_REMOVE_OLD
+	SUMMARIES_ADD_NEW
+	"END",
+
+	/*
+	 * 4: Daily (0), ISO weekly (1) & monthly (2) totals per
+	 *    entity/project/sub_project, again maintained by triggers.
+	 *    bucket is the date the day/week/month starts on, weeks start
+	 *    on a Monday.
+	 */
+	"CREATE TABLE rollups (period INT, bucket TEXT, "
+	"entity TEXT COLLATE NOCASE, project TEXT COLLATE NOCASE, "
+	"sub_project TEXT COLLATE NOCASE, duration INT, entries INT, "
+	"PRIMARY KEY (period, bucket, entity, project, sub_project)) "
+	"WITHOUT ROWID;"
+
+	ROLLUPS_POPULATE("0", ROLLUP_DAY_BUCKET("date"))
+	ROLLUPS_POPULATE("1", ROLLUP_WEEK_BUCKET("date"))
+	ROLLUPS_POPULATE("2", ROLLUP_MONTH_BUCKET("date"))
+
+	"CREATE TRIGGER tempus_rollups_ai AFTER INSERT ON tempus BEGIN "
+	ROLLUPS_ADD_NEW
+	"END;"
+
+	"CREATE TRIGGER tempus_rollups_ad AFTER DELETE ON tempus BEGIN "
+	ROLLUPS_REMOVE_OLD
+	"END;"
+
+	"CREATE TRIGGER tempus_rollups_au AFTER UPDATE ON tempus BEGIN "
+	ROLLUPS_REMOVE_OLD
+	ROLLUPS_ADD_NEW
+	"END",
+
+	/*
+	 * 5: Store each entity, project & sub_project name once, in its
+	 *    own table, with entries referring to them by id. Names are
+	 *    unique case insensitively (as the summaries already grouped
+	 *    them), the first spelling used is kept.
+	 *
+	 *    tempus becomes a view of entries with the names joined back
+	 *    in, so it still reads as it always has. New names are added
+	 *    by inserting them into the tempus_names view.
+	 *
+	 *    summaries & rollups are rebuilt to group by id.
+	 */
+	DIMENSION_TABLE("entities")
+	DIMENSION_TABLE("projects")
+	DIMENSION_TABLE("sub_projects")
+
+	"INSERT OR IGNORE INTO entities (name) "
+	"SELECT ifnull(entity, '') FROM tempus ORDER BY id;"
+	"INSERT OR IGNORE INTO projects (name) "
+	"SELECT ifnull(project, '') FROM tempus ORDER BY id;"
+	"INSERT OR IGNORE INTO sub_projects (name) "
+	"SELECT ifnull(sub_project, '') FROM tempus ORDER BY id;"
+
+	"CREATE TABLE entries (id INTEGER PRIMARY KEY, date TEXT, "
+	"entity_id INTEGER NOT NULL REFERENCES entities (id), "
+	"project_id INTEGER NOT NULL REFERENCES projects (id), "
+	"sub_project_id INTEGER NOT NULL REFERENCES sub_projects (id), "
+	"duration INT, description TEXT);"
+
+	"INSERT INTO entries SELECT t.id, t.date, e.id, p.id, s.id, "
+	"t.duration, t.description FROM tempus t "
+	"JOIN entities e ON e.name = ifnull(t.entity, '') "
+	"JOIN projects p ON p.name = ifnull(t.project, '') "
+	"JOIN sub_projects s ON s.name = ifnull(t.sub_project, '');"
+
+	/* Takes its indexes & triggers with it */
+	"DROP TABLE tempus;"
+	"DROP TABLE summaries;"
+	"DROP TABLE rollups;"
+
+	"CREATE INDEX entries_date_idx ON entries (date);"
+	"CREATE INDEX entries_group_idx ON entries "
+	"(entity_id, project_id, sub_project_id, date);"
+
+	"CREATE VIEW tempus AS SELECT t.id AS id, t.date AS date, "
+	"e.name AS entity, p.name AS project, s.name AS sub_project, "
+	"t.duration AS duration, t.description AS description "
+	"FROM entries t "
+	"JOIN entities e ON e.id = t.entity_id "
+	"JOIN projects p ON p.id = t.project_id "
+	"JOIN sub_projects s ON s.id = t.sub_project_id;"
+
+	"CREATE VIEW tempus_names AS SELECT e.name AS entity, "
+	"p.name AS project, s.name AS sub_project "
+	"FROM entities e, projects p, sub_projects s WHERE 0;"
+
+	"CREATE TRIGGER tempus_names_add INSTEAD OF INSERT ON tempus_names "
+	"BEGIN "
+	"INSERT OR IGNORE INTO entities (name) "
+	"VALUES (ifnull(NEW.entity, ''));"
+	"INSERT OR IGNORE INTO projects (name) "
+	"VALUES (ifnull(NEW.project, ''));"
+	"INSERT OR IGNORE INTO sub_projects (name) "
+	"VALUES (ifnull(NEW.sub_project, ''));"
+	"END;"
+
+	"CREATE TABLE summaries (entity_id INTEGER, project_id INTEGER, "
+	"sub_project_id INTEGER, first_date TEXT, last_date TEXT, "
+	"duration INT, entries INT, "
+	"PRIMARY KEY (entity_id, project_id, sub_project_id)) WITHOUT ROWID;"
+
+	"INSERT INTO summaries SELECT entity_id, project_id, sub_project_id, "
+	"min(date), max(date), sum(duration), count(*) FROM entries "
+	"GROUP BY entity_id, project_id, sub_project_id;"
+
+	"CREATE TRIGGER entries_summaries_ai AFTER INSERT ON entries BEGIN "
+	ENTRIES_SUMMARIES_ADD_NEW
+	"END;"
+
+	"CREATE TRIGGER entries_summaries_ad AFTER DELETE ON entries BEGIN "
+	ENTRIES_SUMMARIES_REMOVE_OLD
+	"END;"
+
+	"CREATE TRIGGER entries_summaries_au AFTER UPDATE ON entries BEGIN "
+	ENTRIES_SUMMARIES_REMOVE_OLD
+	ENTRIES_SUMMARIES_ADD_NEW
+	"END;"
+
+	"CREATE TABLE rollups (period INT, bucket TEXT, entity_id INTEGER, "
+	"project_id INTEGER, sub_project_id INTEGER, duration INT, "
+	"entries INT, PRIMARY KEY "
+	"(period, bucket, entity_id, project_id, sub_project_id)) "
+	"WITHOUT ROWID;"
+
+	ENTRIES_ROLLUPS_POPULATE("0", ROLLUP_DAY_BUCKET("date"))
+	ENTRIES_ROLLUPS_POPULATE("1", ROLLUP_WEEK_BUCKET("date"))
+	ENTRIES_ROLLUPS_POPULATE("2", ROLLUP_MONTH_BUCKET("date"))
+
+	"CREATE TRIGGER entries_rollups_ai AFTER INSERT ON entries BEGIN "
+	ENTRIES_ROLLUPS_ADD_NEW
+	"END;"
+
+	"CREATE TRIGGER entries_rollups_ad AFTER DELETE ON entries BEGIN "
+	ENTRIES_ROLLUPS_REMOVE_OLD
+	"END;"
+
+	"CREATE TRIGGER entries_rollups_au AFTER UPDATE ON entries BEGIN "
+	ENTRIES_ROLLUPS_REMOVE_OLD
+	ENTRIES_ROLLUPS_ADD_NEW
+	"END",
+
+	/*
+	 * 6: Each entry's date as a day number (see date.c), so date
+	 *    ranges are integer comparisons. It's set along with date by
+	 *    SQL_INSERT & SQL_UPDATE.
+	 *
+	 *    tempus gains it as its last column.
+	 */
+	"ALTER TABLE entries ADD COLUMN day INTEGER;"
+	"UPDATE entries SET day = " DATE_SQL_DAY("date") ";"
+
+	"DROP INDEX entries_date_idx;"
+	"CREATE INDEX entries_day_idx ON entries (day);"
+
+	"DROP VIEW tempus;"
+	"CREATE VIEW tempus AS SELECT t.id AS id, t.date AS date, "
+	"e.name AS entity, p.name AS project, s.name AS sub_project, "
+	"t.duration AS duration, t.description AS description, "
+	"t.day AS day "
+	"FROM entries t "
+	"JOIN entities e ON e.id = t.entity_id "
+	"JOIN projects p ON p.id = t.project_id "
+	"JOIN sub_projects s ON s.id = t.sub_project_id",
+
+	/*
+	 * 7: A full text index of the descriptions & names. It reads its
+	 *    content from tempus rather than keeping its own copy, so the
+	 *    triggers give it the names looked up from their tables.
+	 */
+	"CREATE VIRTUAL TABLE entries_fts USING fts5 (description, entity, "
+	"project, sub_project, content = 'tempus', content_rowid = 'id', "
+	"tokenize = 'unicode61 remove_diacritics 2', prefix = '2 3');"
+
+	"INSERT INTO entries_fts (entries_fts) VALUES ('rebuild');"
+
+	"CREATE TRIGGER entries_fts_ai AFTER INSERT ON entries BEGIN "
+	ENTRIES_FTS_ADD_NEW
+	"END;"
+
+	"CREATE TRIGGER entries_fts_ad AFTER DELETE ON entries BEGIN "
+	ENTRIES_FTS_REMOVE_OLD
+	"END;"
+
+	"CREATE TRIGGER entries_fts_au AFTER UPDATE OF description, "
+	"entity_id, project_id, sub_project_id ON entries BEGIN "
+	ENTRIES_FTS_REMOVE_OLD
+	ENTRIES_FTS_ADD_NEW
+	"END",
+
+	/*
+	 * 8: Count the entries ever updated or deleted, so a copy of them
+	 *    (the history snapshot) can tell if it's out of date. New
+	 *    entries are told by their id.
+	 */
+	"CREATE TABLE entry_changes (nr INTEGER NOT NULL);"
+	"INSERT INTO entry_changes VALUES (0);"
+
+	"CREATE TRIGGER entry_changes_au AFTER UPDATE ON entries BEGIN "
+	"UPDATE entry_changes SET nr = nr + 1; "
+	"END;"
+
+	"CREATE TRIGGER entry_changes_ad AFTER DELETE ON entries BEGIN "
+	"UPDATE entry_changes SET nr = nr + 1; "
+	"END",
+
+	/*
+	 * 9: Keep the full text index right when a name is renamed. As
+	 *    it may already have been thrown out by one, it's rebuilt.
+	 */
+	NAME_FTS_RENAME("entities", "entity_id", "OLD.name", "project",
+			"sub_project")
+	NAME_FTS_RENAME("projects", "project_id", "entity", "OLD.name",
+			"sub_project")
+	NAME_FTS_RENAME("sub_projects", "sub_project_id", "entity", "project",
+			"OLD.name")
+
+	"INSERT INTO entries_fts (entries_fts) VALUES ('rebuild')",
+
+	/*
+	 * 10: Renaming a name changes its entries as much as updating
+	 *     them, so it's counted in entry_changes too.
+	 */
+	"CREATE TRIGGER entities_changes_au AFTER UPDATE OF name ON entities "
+	"BEGIN UPDATE entry_changes SET nr = nr + 1; END;"
+
+	"CREATE TRIGGER projects_changes_au AFTER UPDATE OF name ON projects "
+	"BEGIN UPDATE entry_changes SET nr = nr + 1; END;"
+
+	"CREATE TRIGGER sub_projects_changes_au AFTER UPDATE OF name ON "
+	"sub_projects BEGIN UPDATE entry_changes SET nr = nr + 1; END",
+};
+
+#define SCHEMA_VERSION	(int)(sizeof(migrations) / sizeof(migrations[0]))
+
+static int get_schema_version(sqlite3 *db)
+{
+	sqlite3_stmt *stmt;
+	int version = -1;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &stmt, NULL);
+	if (rc != SQLITE_OK)
+		return -1;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		version = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	return version;
+}
+
+static int migrate_to(sqlite3 *db, int version)
+{
+	char sql[64];
+	int rc;
+
+	rc = sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+	if (rc != SQLITE_OK)
+		goto out_rollback;
+
+	rc = sqlite3_exec(db, migrations[version - 1], NULL, NULL, NULL);
+	if (rc != SQLITE_OK)
+		goto out_rollback;
+
+	/* PRAGMA's don't take bound parameters */
+	snprintf(sql, sizeof(sql), "PRAGMA user_version = %d", version);
+	rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+	if (rc != SQLITE_OK)
+		goto out_rollback;
+
+	rc = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+	if (rc != SQLITE_OK)
+		goto out_rollback;
+
+	return 0;
+
+out_rollback:
+	fprintf(stderr, "Schema migration to version %d failed: %s\n",
+		version, sqlite3_errmsg(db));
+	sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+
+	return -1;
+}
+
+/* Whether there's anything in the database yet, i.e it isn't brand new */
+static bool has_tables(sqlite3 *db)
+{
+	sqlite3_stmt *stmt;
+	bool ret = false;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master LIMIT 1", -1,
+				&stmt, NULL);
+	if (rc != SQLITE_OK)
+		return false;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		ret = true;
+	sqlite3_finalize(stmt);
+
+	return ret;
+}
+
+/*
+ * For read-only users of the database who can't migrate it themselves.
+ */
+bool schema_is_current(sqlite3 *db)
+{
+	return get_schema_version(db) == SCHEMA_VERSION;
+}
+
+/*
+ * Bring the database schema up to date, applying each outstanding
+ * migration in its own transaction.
+ *
+ * Upgrading an existing database can leave a lot of free space in it
+ * (e.g version 5 moving everything out of tempus), so it's vacuumed
+ * afterwards. That includes those from before the schema was versioned,
+ * which are at version 0 along with newly created ones.
+ */
+int schema_migrate(sqlite3 *db)
+{
+	int version = get_schema_version(db);
+	bool upgrade = version < SCHEMA_VERSION && has_tables(db);
+	int rc;
+
+	if (version < 0) {
+		fprintf(stderr, "Cannot get schema version: %s\n",
+			sqlite3_errmsg(db));
+		return -1;
+	}
+
+	if (version > SCHEMA_VERSION) {
+		fprintf(stderr,
+			"Database schema version (%d) is newer than this "
+			"version of tempus supports (%d)\n",
+			version, SCHEMA_VERSION);
+		return -1;
+	}
+
+	while (version < SCHEMA_VERSION) {
+		int err = migrate_to(db, ++version);
+
+		if (err)
+			return err;
+	}
+
+	if (!upgrade)
+		return 0;
+
+	rc = sqlite3_exec(db, "VACUUM", NULL, NULL, NULL);
+	if (rc != SQLITE_OK)
+		fprintf(stderr, "Cannot vacuum database: %s\n",
+			sqlite3_errmsg(db));
+
+	return 0;
+}
@@ -0,0 +1,20 @@
+/*
+ * schema.h - Database schema versioning & migrations
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _SCHEMA_H_
+#define _SCHEMA_H_
+
+#include <stdbool.h>
+
+#include <sqlite3.h>
+
+extern bool schema_is_current(sqlite3 *db);
+extern int schema_migrate(sqlite3 *db);
+
+#endif /* _SCHEMA_H_ */
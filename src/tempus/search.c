@@ -0,0 +1,227 @@
+/*
+ * search.c - Full text search of the entries
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <gtk/gtk.h>
+
+#include <sqlite3.h>
+
+#include "tempus.h"
+#include "db.h"
+#include "util.h"
+#include "date.h"
+#include "stats.h"
+#include "search.h"
+
+enum search_column {
+	COL_DATE = 0,
+	COL_ENTITY,
+	COL_PROJECT,
+	COL_SUB_PROJECT,
+	COL_DURATION,
+	COL_DESCRIPTION
+};
+
+/* The most results shown, the best matches come first anyway */
+#define SEARCH_LIMIT		500
+
+struct search_result {
+	char date[DATE_STR_LEN];
+	char *entity;
+	char *project;
+	char *sub_project;
+	char *description;
+	int duration;
+};
+
+/*
+ * The query is run on the database thread against the entries_fts index
+ * (see schema.c), so it doesn't matter how much history there is. Each
+ * change to the search starts a new job, the results of any previous
+ * one are discarded.
+ */
+struct search_job {
+	struct widgets *w;
+
+	gint cancelled;
+
+	char *query;
+	int from;
+	int to;
+
+	GPtrArray *results;
+	bool error;
+};
+
+static struct search_job *current_job;
+
+static void free_result(gpointer data)
+{
+	struct search_result *res = data;
+
+	g_free(res->entity);
+	g_free(res->project);
+	g_free(res->sub_project);
+	g_free(res->description);
+	g_slice_free(struct search_result, res);
+}
+
+static void free_search_job(struct search_job *job)
+{
+	g_free(job->query);
+	g_ptr_array_free(job->results, true);
+	g_slice_free(struct search_job, job);
+}
+
+static void search_work(void *data)
+{
+	struct search_job *job = data;
+	sqlite3_stmt *stmt;
+	u64 start;
+	int rc;
+
+	if (g_atomic_int_get(&job->cancelled))
+		return;
+
+	start = stats_begin();
+
+	stmt = db_stmt(DB_STMT_SEARCH);
+	sqlite3_bind_text(stmt, 1, job->query, -1, NULL);
+	sqlite3_bind_int(stmt, 2, job->from);
+	sqlite3_bind_int(stmt, 3, job->to);
+	sqlite3_bind_int(stmt, 4, SEARCH_LIMIT);
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		struct search_result *res;
+
+		if (g_atomic_int_get(&job->cancelled))
+			break;
+
+		res = g_slice_new(struct search_result);
+		snprintf(res->date, sizeof(res->date), "%s",
+			 (char *)sqlite3_column_text(stmt, SQL_COL_DATE));
+		res->entity = g_strdup((char *)sqlite3_column_text(stmt,
+						SQL_COL_ENTITY));
+		res->project = g_strdup((char *)sqlite3_column_text(stmt,
+						SQL_COL_PROJECT));
+		res->sub_project = g_strdup((char *)sqlite3_column_text(stmt,
+						SQL_COL_SUB_PROJECT));
+		res->description = g_strdup((char *)sqlite3_column_text(stmt,
+						SQL_COL_DESCRIPTION));
+		res->duration = sqlite3_column_int(stmt, SQL_COL_DURATION);
+
+		g_ptr_array_add(job->results, res);
+	}
+	if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+		fprintf(stderr, "Search failed: %s\n",
+			sqlite3_errmsg(db_get()));
+		job->error = true;
+	}
+	sqlite3_reset(stmt);
+
+	stats_count(STAT_SEARCH_ROWS, job->results->len);
+	stats_end(STAT_SEARCH_QUERY, start);
+}
+
+static void set_status(struct widgets *w, const char *fmt, guint n)
+{
+	char status[64];
+
+	snprintf(status, sizeof(status), fmt, n);
+	gtk_label_set_text(GTK_LABEL(w->search_status), status);
+}
+
+static gboolean search_done(gpointer data)
+{
+	struct search_job *job = data;
+	struct widgets *w = job->w;
+	guint i;
+
+	if (job != current_job || g_atomic_int_get(&job->cancelled))
+		goto out_free;
+	current_job = NULL;
+
+	for (i = 0; i < job->results->len; i++) {
+		const struct search_result *res =
+				g_ptr_array_index(job->results, i);
+		char dbuf[16];
+
+		secs_to_dur(res->duration, dbuf, sizeof(dbuf), NULL);
+		gtk_list_store_insert_with_values(w->search_ls, NULL, -1,
+						  COL_DATE, res->date,
+						  COL_ENTITY, res->entity,
+						  COL_PROJECT, res->project,
+						  COL_SUB_PROJECT,
+						  res->sub_project,
+						  COL_DURATION, dbuf,
+						  COL_DESCRIPTION,
+						  res->description,
+						  -1);
+	}
+
+	if (job->error)
+		gtk_label_set_text(GTK_LABEL(w->search_status),
+				   "Search failed");
+	else if (job->results->len >= SEARCH_LIMIT)
+		set_status(w, "Showing the best %u matches", SEARCH_LIMIT);
+	else if (job->results->len == 1)
+		gtk_label_set_text(GTK_LABEL(w->search_status), "1 match");
+	else
+		set_status(w, "%u matches", job->results->len);
+
+out_free:
+	free_search_job(job);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Abandon any search in progress, e.g when the window is closed */
+void search_cancel(void)
+{
+	if (!current_job)
+		return;
+
+	g_atomic_int_set(&current_job->cancelled, 1);
+	current_job = NULL;
+}
+
+static int get_search_day(GtkWidget *entry, int none)
+{
+	int day = date_to_day(gtk_entry_get_text(GTK_ENTRY(entry)));
+
+	return day == DATE_NONE ? none : day;
+}
+
+/* Search for whatever is in the search box, within the dates given */
+void do_search(struct widgets *w)
+{
+	struct search_job *job;
+	char *query;
+
+	search_cancel();
+
+	gtk_list_store_clear(w->search_ls);
+	gtk_label_set_text(GTK_LABEL(w->search_status), "");
+
+	query = db_fts_query(gtk_entry_get_text(GTK_ENTRY(w->search_entry)));
+	if (!query)
+		return;
+
+	job = g_slice_new0(struct search_job);
+	job->w = w;
+	job->query = query;
+	job->from = get_search_day(w->search_from, DATE_NONE);
+	job->to = get_search_day(w->search_to, DATE_MAX);
+	job->results = g_ptr_array_new_with_free_func(free_result);
+	current_job = job;
+
+	db_submit(search_work, search_done, job);
+}
@@ -0,0 +1,18 @@
+/*
+ * search.h - Full text search of the entries
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _SEARCH_H_
+#define _SEARCH_H_
+
+#include "tempus.h"
+
+extern void search_cancel(void);
+extern void do_search(struct widgets *w);
+
+#endif /* _SEARCH_H_ */
@@ -0,0 +1,318 @@
+/*
+ * snapshot.c - Snapshot of the history window for a quick start up
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "short_types.h"
+#include "snapshot.h"
+
+/*
+ * The snapshot is a private cache, so it's in the machine's own byte
+ * order, laid out as
+ *
+ *	magic, version
+ *	struct snapshot_key		changes, max_id, nr_entries,
+ *					from_day
+ *	nr_rows, nr_completions
+ *	rows				id, day, duration, flags, date,
+ *					entity, project, sub_project
+ *	completions			day, count, entity, project,
+ *					sub_project
+ *
+ * with integers unaligned & strings NUL terminated. Anything that
+ * doesn't add up is taken as there being no snapshot.
+ */
+#define SNAPSHOT_MAGIC		"tempusss"
+#define SNAPSHOT_VERSION	1
+
+#define ROW_HAS_DESCRIPTION	0x01
+
+/* The least a row or completion can take, with empty strings */
+#define ROW_MIN_SIZE		(8 + 4 + 4 + 1 + 4)
+#define COMPLETION_MIN_SIZE	(4 + 4 + 3)
+
+struct snapshot_writer {
+	GString *rows;
+	GString *completions;
+	u32 nr_rows;
+	u32 nr_completions;
+};
+
+/* Reading through the mapped snapshot */
+struct cursor {
+	const char *ptr;
+	const char *end;
+};
+
+static bool get_bytes(struct cursor *c, void *buf, size_t len)
+{
+	if ((size_t)(c->end - c->ptr) < len)
+		return false;
+
+	memcpy(buf, c->ptr, len);
+	c->ptr += len;
+
+	return true;
+}
+
+static bool get_u32(struct cursor *c, u32 *val)
+{
+	return get_bytes(c, val, sizeof(u32));
+}
+
+static bool get_int(struct cursor *c, int *val)
+{
+	s32 v;
+
+	if (!get_bytes(c, &v, sizeof(v)))
+		return false;
+	*val = v;
+
+	return true;
+}
+
+static bool get_s64(struct cursor *c, gint64 *val)
+{
+	return get_bytes(c, val, sizeof(gint64));
+}
+
+static bool get_str(struct cursor *c, const char **str)
+{
+	const char *nul = memchr(c->ptr, '\0', c->end - c->ptr);
+
+	if (!nul)
+		return false;
+
+	*str = c->ptr;
+	c->ptr = nul + 1;
+
+	return true;
+}
+
+static bool get_key(struct cursor *c, struct snapshot_key *key)
+{
+	return get_s64(c, &key->changes) && get_s64(c, &key->max_id) &&
+	       get_s64(c, &key->nr_entries) && get_int(c, &key->from_day);
+}
+
+static bool get_row(struct cursor *c, struct snapshot_row *row)
+{
+	u8 flags;
+
+	if (!get_s64(c, &row->id) || !get_int(c, &row->day) ||
+	    !get_int(c, &row->duration) || !get_bytes(c, &flags, 1))
+		return false;
+	row->has_description = flags & ROW_HAS_DESCRIPTION;
+
+	return get_str(c, &row->date) && get_str(c, &row->entity) &&
+	       get_str(c, &row->project) && get_str(c, &row->sub_project);
+}
+
+static bool get_completion(struct cursor *c, struct snapshot_completion *comp)
+{
+	return get_int(c, &comp->day) && get_u32(c, &comp->count) &&
+	       get_str(c, &comp->entity) && get_str(c, &comp->project) &&
+	       get_str(c, &comp->sub_project);
+}
+
+/*
+ * Map in the snapshot at path. Returns NULL if there isn't one, or it's
+ * not one we understand, otherwise it's to be freed with
+ * snapshot_free().
+ *
+ * Whether it's still good is up to the caller, see struct snapshot_key.
+ */
+struct snapshot *snapshot_open(const char *path)
+{
+	struct snapshot *snap;
+	struct cursor c;
+	char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+	u32 version;
+	u32 nr_rows;
+	u32 nr_completions;
+	u32 i;
+
+	snap = g_slice_new0(struct snapshot);
+	snap->file = g_mapped_file_new(path, false, NULL);
+	if (!snap->file)
+		goto out_free;
+
+	c.ptr = g_mapped_file_get_contents(snap->file);
+	c.end = c.ptr + g_mapped_file_get_length(snap->file);
+
+	if (!get_bytes(&c, magic, sizeof(magic)) ||
+	    memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 ||
+	    !get_u32(&c, &version) || version != SNAPSHOT_VERSION ||
+	    !get_key(&c, &snap->key) || !get_u32(&c, &nr_rows) ||
+	    !get_u32(&c, &nr_completions))
+		goto out_bad;
+
+	/* Don't go allocating for more than there could be */
+	if (nr_rows > (c.end - c.ptr) / ROW_MIN_SIZE ||
+	    nr_completions > (c.end - c.ptr) / COMPLETION_MIN_SIZE)
+		goto out_bad;
+
+	snap->rows = g_array_sized_new(false, false,
+				       sizeof(struct snapshot_row), nr_rows);
+	snap->completions = g_array_sized_new(false, false,
+					sizeof(struct snapshot_completion),
+					nr_completions);
+
+	for (i = 0; i < nr_rows; i++) {
+		struct snapshot_row row;
+
+		if (!get_row(&c, &row))
+			goto out_bad;
+		g_array_append_val(snap->rows, row);
+	}
+
+	for (i = 0; i < nr_completions; i++) {
+		struct snapshot_completion comp;
+
+		if (!get_completion(&c, &comp))
+			goto out_bad;
+		g_array_append_val(snap->completions, comp);
+	}
+
+	if (c.ptr != c.end)
+		goto out_bad;
+
+	return snap;
+
+out_bad:
+	fprintf(stderr, "Ignoring unrecognised snapshot %s\n", path);
+out_free:
+	snapshot_free(snap);
+
+	return NULL;
+}
+
+void snapshot_free(struct snapshot *snap)
+{
+	if (!snap)
+		return;
+
+	if (snap->rows)
+		g_array_free(snap->rows, true);
+	if (snap->completions)
+		g_array_free(snap->completions, true);
+	if (snap->file)
+		g_mapped_file_unref(snap->file);
+	g_slice_free(struct snapshot, snap);
+}
+
+static void put_u32(GString *buf, u32 val)
+{
+	g_string_append_len(buf, (const char *)&val, sizeof(val));
+}
+
+static void put_int(GString *buf, int val)
+{
+	s32 v = val;
+
+	g_string_append_len(buf, (const char *)&v, sizeof(v));
+}
+
+static void put_s64(GString *buf, gint64 val)
+{
+	g_string_append_len(buf, (const char *)&val, sizeof(val));
+}
+
+/* Including the NUL terminator, NULL is stored as "" */
+static void put_str(GString *buf, const char *str)
+{
+	if (!str)
+		str = "";
+	g_string_append_len(buf, str, strlen(str) + 1);
+}
+
+struct snapshot_writer *snapshot_writer_new(void)
+{
+	struct snapshot_writer *sw = g_slice_new(struct snapshot_writer);
+
+	sw->rows = g_string_sized_new(64 * 1024);
+	sw->completions = g_string_sized_new(16 * 1024);
+	sw->nr_rows = 0;
+	sw->nr_completions = 0;
+
+	return sw;
+}
+
+/* Rows are to be added newest first, as they're listed */
+void snapshot_add_row(struct snapshot_writer *sw,
+		      const struct snapshot_row *row)
+{
+	u8 flags = row->has_description ? ROW_HAS_DESCRIPTION : 0;
+
+	put_s64(sw->rows, row->id);
+	put_int(sw->rows, row->day);
+	put_int(sw->rows, row->duration);
+	g_string_append_c(sw->rows, flags);
+	put_str(sw->rows, row->date);
+	put_str(sw->rows, row->entity);
+	put_str(sw->rows, row->project);
+	put_str(sw->rows, row->sub_project);
+	sw->nr_rows++;
+}
+
+void snapshot_add_completion(struct snapshot_writer *sw,
+			     const struct snapshot_completion *comp)
+{
+	put_int(sw->completions, comp->day);
+	put_u32(sw->completions, comp->count);
+	put_str(sw->completions, comp->entity);
+	put_str(sw->completions, comp->project);
+	put_str(sw->completions, comp->sub_project);
+	sw->nr_completions++;
+}
+
+/*
+ * Write out what's been added as the snapshot of key to path. It
+ * replaces any previous snapshot in one go, so a snapshot is never
+ * seen half written.
+ */
+int snapshot_write(struct snapshot_writer *sw,
+		   const struct snapshot_key *key, const char *path)
+{
+	GString *buf = g_string_sized_new(64 + sw->rows->len +
+					  sw->completions->len);
+	GError *error = NULL;
+	int err = 0;
+
+	g_string_append_len(buf, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC) - 1);
+	put_u32(buf, SNAPSHOT_VERSION);
+	put_s64(buf, key->changes);
+	put_s64(buf, key->max_id);
+	put_s64(buf, key->nr_entries);
+	put_int(buf, key->from_day);
+	put_u32(buf, sw->nr_rows);
+	put_u32(buf, sw->nr_completions);
+	g_string_append_len(buf, sw->rows->str, sw->rows->len);
+	g_string_append_len(buf, sw->completions->str, sw->completions->len);
+
+	if (!g_file_set_contents(path, buf->str, buf->len, &error)) {
+		fprintf(stderr, "Cannot write snapshot: %s\n", error->message);
+		g_error_free(error);
+		err = -1;
+	}
+	g_string_free(buf, true);
+
+	return err;
+}
+
+void snapshot_writer_free(struct snapshot_writer *sw)
+{
+	g_string_free(sw->rows, true);
+	g_string_free(sw->completions, true);
+	g_slice_free(struct snapshot_writer, sw);
+}
@@ -0,0 +1,69 @@
+/*
+ * snapshot.h - Snapshot of the history window for a quick start up
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdbool.h>
+
+#include <glib.h>
+
+#include "short_types.h"
+
+/* What the snapshot was taken of, to check it against the database */
+struct snapshot_key {
+	gint64 changes;		/* Entries updated, deleted or renamed, ever */
+	gint64 max_id;		/* Of the entries */
+	gint64 nr_entries;
+	int from_day;		/* Start of the history window */
+};
+
+/* The strings of these point into the snapshot */
+struct snapshot_row {
+	gint64 id;
+	int day;
+	int duration;
+	bool has_description;
+	const char *date;
+	const char *entity;
+	const char *project;
+	const char *sub_project;
+};
+
+struct snapshot_completion {
+	int day;
+	u32 count;
+	const char *entity;
+	const char *project;
+	const char *sub_project;
+};
+
+struct snapshot {
+	struct snapshot_key key;
+	GArray *rows;		/* struct snapshot_row, newest first */
+	GArray *completions;	/* struct snapshot_completion */
+
+	GMappedFile *file;
+};
+
+struct snapshot_writer;
+
+extern struct snapshot *snapshot_open(const char *path);
+extern void snapshot_free(struct snapshot *snap);
+
+extern struct snapshot_writer *snapshot_writer_new(void);
+extern void snapshot_add_row(struct snapshot_writer *sw,
+			     const struct snapshot_row *row);
+extern void snapshot_add_completion(struct snapshot_writer *sw,
+				    const struct snapshot_completion *comp);
+extern int snapshot_write(struct snapshot_writer *sw,
+			  const struct snapshot_key *key, const char *path);
+extern void snapshot_writer_free(struct snapshot_writer *sw);
+
+#endif /* _SNAPSHOT_H_ */
@@ -0,0 +1,274 @@
+/*
+ * stats.c - Timing & counters for diagnosing where time goes
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#define _POSIX_C_SOURCE	200809L		/* clock_gettime(2) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <sqlite3.h>
+
+#include <glib.h>
+
+#include "short_types.h"
+#include "stats.h"
+
+/*
+ * Past this many samples, a random subset of them is kept for working
+ * out the percentiles. The count & total are always exact.
+ */
+#define STATS_MAX_SAMPLES	4096
+
+struct stats_entry {
+	const char *name;
+	bool counter;		/* Just a count, no timings */
+
+	u64 count;
+	u64 total;		/* ns */
+	GArray *samples;	/* u64 ns */
+};
+
+static struct stats_entry stats[STAT_MAX] = {
+	[STAT_STARTUP]		= { "startup" },
+	[STAT_DB_OPEN]		= { "db open" },
+	[STAT_DB_MIGRATE]	= { "db migrate" },
+	[STAT_DB_PREPARE]	= { "db prepare" },
+	[STAT_HISTORY_QUERY]	= { "history query" },
+	[STAT_HISTORY_ROWS]	= { "history rows", true },
+	[STAT_HISTORY_FILL]	= { "history fill" },
+	[STAT_DATE_HDR]		= { "date header" },
+	[STAT_SAVE]		= { "save" },
+	[STAT_SUMMARIES_QUERY]	= { "summaries query" },
+	[STAT_SUMMARIES_ROWS]	= { "summaries rows", true },
+	[STAT_SUMMARIES_FILL]	= { "summaries fill" },
+	[STAT_SEARCH_QUERY]	= { "search query" },
+	[STAT_SEARCH_ROWS]	= { "search rows", true },
+	[STAT_SNAPSHOT_LOAD]	= { "snapshot load" },
+	[STAT_SNAPSHOT_SAVE]	= { "snapshot save" },
+};
+
+/* Per statement timings from sqlite's profile hook, keyed by the SQL */
+static GHashTable *sql_stats;
+/*
+ * When each statement started running. sqlite's own profile timings
+ * only have millisecond resolution.
+ */
+static GHashTable *stmt_starts;
+
+/* Spans are recorded from both the main & database threads */
+static GMutex stats_lock;
+static bool enabled;
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Must be called with stats_lock held */
+static void add_sample(struct stats_entry *entry, u64 ns)
+{
+	entry->count++;
+	entry->total += ns;
+
+	if (!entry->samples)
+		entry->samples = g_array_new(false, false, sizeof(u64));
+
+	if (entry->samples->len < STATS_MAX_SAMPLES) {
+		g_array_append_val(entry->samples, ns);
+	} else {
+		u64 i = g_random_double() * entry->count;
+
+		if (i < STATS_MAX_SAMPLES)
+			g_array_index(entry->samples, u64, i) = ns;
+	}
+}
+
+static int trace_cb(unsigned int type, void *ctx __attribute__((unused)),
+		    void *p, void *x)
+{
+	const char *sql = sqlite3_sql(p);
+	struct stats_entry *entry;
+	u64 *start;
+	u64 ns;
+
+	g_mutex_lock(&stats_lock);
+
+	start = g_hash_table_lookup(stmt_starts, p);
+	if (type == SQLITE_TRACE_STMT) {
+		/* Triggers starting show up as "-- TRIGGER ..." */
+		if (strncmp(x, "--", 2) != 0) {
+			if (!start) {
+				start = g_new(u64, 1);
+				g_hash_table_insert(stmt_starts, p, start);
+			}
+			*start = now_ns();
+		}
+		goto out_unlock;
+	}
+
+	ns = start ? now_ns() - *start : (u64)*(sqlite3_int64 *)x;
+	g_hash_table_remove(stmt_starts, p);
+
+	entry = g_hash_table_lookup(sql_stats, sql);
+	if (!entry) {
+		entry = g_slice_new0(struct stats_entry);
+		entry->name = g_strdup(sql);
+		g_hash_table_insert(sql_stats, (gpointer)entry->name, entry);
+	}
+	add_sample(entry, ns);
+
+out_unlock:
+	g_mutex_unlock(&stats_lock);
+
+	return 0;
+}
+
+/*
+ * Enable collecting stats if either enable is true or STATS_ENV is set.
+ * Otherwise the rest of these functions do nothing.
+ */
+void stats_init(bool enable)
+{
+	enabled = enable || getenv(STATS_ENV);
+	if (enabled && !sql_stats) {
+		sql_stats = g_hash_table_new(g_str_hash, g_str_equal);
+		stmt_starts = g_hash_table_new_full(g_direct_hash,
+						    g_direct_equal, NULL,
+						    g_free);
+	}
+}
+
+bool stats_enabled(void)
+{
+	return enabled;
+}
+
+/*
+ * Start a span, the returned value is then passed to stats_end(). A
+ * value of 0 means stats aren't enabled.
+ */
+u64 stats_begin(void)
+{
+	return enabled ? now_ns() : 0;
+}
+
+void stats_end(enum stat_id id, u64 start)
+{
+	u64 ns;
+
+	if (!start)
+		return;
+
+	ns = now_ns() - start;
+
+	g_mutex_lock(&stats_lock);
+	add_sample(&stats[id], ns);
+	g_mutex_unlock(&stats_lock);
+}
+
+void stats_count(enum stat_id id, u64 n)
+{
+	if (!enabled)
+		return;
+
+	g_mutex_lock(&stats_lock);
+	stats[id].count += n;
+	g_mutex_unlock(&stats_lock);
+}
+
+/* Time every statement run on db */
+void stats_trace_db(sqlite3 *db)
+{
+	if (!enabled)
+		return;
+
+	sqlite3_trace_v2(db, SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE,
+			 trace_cb, NULL);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a;
+	u64 y = *(const u64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int cmp_total(gconstpointer a, gconstpointer b)
+{
+	const struct stats_entry *x = a;
+	const struct stats_entry *y = b;
+
+	return (x->total < y->total) - (x->total > y->total);
+}
+
+static void print_entry(FILE *fp, const struct stats_entry *entry)
+{
+	u64 *sorted;
+	guint len;
+
+	if (!entry->count)
+		return;
+
+	if (entry->counter) {
+		fprintf(fp, "%10llu %10s %10s %10s  %s\n",
+			(unsigned long long)entry->count, "", "", "",
+			entry->name);
+		return;
+	}
+
+	len = entry->samples->len;
+	sorted = g_new(u64, len);
+	memcpy(sorted, entry->samples->data, len * sizeof(u64));
+	qsort(sorted, len, sizeof(u64), cmp_u64);
+
+	fprintf(fp, "%10llu %10.3f %10.1f %10.1f  %s\n",
+		(unsigned long long)entry->count, entry->total / 1e6,
+		sorted[len / 2] / 1e3, sorted[len * 99 / 100] / 1e3,
+		entry->name);
+
+	g_free(sorted);
+}
+
+/*
+ * Print the timings so far, the application phases in the order they
+ * happen, followed by the SQL statements, most expensive first.
+ */
+void stats_report(FILE *fp)
+{
+	GList *sql;
+	GList *l;
+	int i;
+
+	if (!enabled)
+		return;
+
+	g_mutex_lock(&stats_lock);
+
+	fprintf(fp, "%10s %10s %10s %10s  %s\n", "count", "total ms",
+		"p50 us", "p99 us", "phase");
+	for (i = 0; i < STAT_MAX; i++)
+		print_entry(fp, &stats[i]);
+
+	fprintf(fp, "\n%10s %10s %10s %10s  %s\n", "count", "total ms",
+		"p50 us", "p99 us", "sql");
+	sql = g_list_sort(g_hash_table_get_values(sql_stats), cmp_total);
+	for (l = sql; l; l = l->next)
+		print_entry(fp, l->data);
+	g_list_free(sql);
+
+	g_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,52 @@
+/*
+ * stats.h - Timing & counters for diagnosing where time goes
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <sqlite3.h>
+
+#include "short_types.h"
+
+/* Set TEMPUS_STATS in the environment to enable */
+#define STATS_ENV	"TEMPUS_STATS"
+
+enum stat_id {
+	STAT_STARTUP = 0,
+	STAT_DB_OPEN,
+	STAT_DB_MIGRATE,
+	STAT_DB_PREPARE,
+	STAT_HISTORY_QUERY,
+	STAT_HISTORY_ROWS,
+	STAT_HISTORY_FILL,
+	STAT_DATE_HDR,
+	STAT_SAVE,
+	STAT_SUMMARIES_QUERY,
+	STAT_SUMMARIES_ROWS,
+	STAT_SUMMARIES_FILL,
+	STAT_SEARCH_QUERY,
+	STAT_SEARCH_ROWS,
+	STAT_SNAPSHOT_LOAD,
+	STAT_SNAPSHOT_SAVE,
+
+	STAT_MAX
+};
+
+extern void stats_init(bool enable);
+extern bool stats_enabled(void);
+extern u64 stats_begin(void);
+extern void stats_end(enum stat_id id, u64 start);
+extern void stats_count(enum stat_id id, u64 n);
+extern void stats_trace_db(sqlite3 *db);
+extern void stats_report(FILE *fp);
+
+#endif /* _STATS_H_ */
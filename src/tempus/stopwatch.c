@@ -0,0 +1,130 @@
+/*
+ * stopwatch.c - Boot time clock based timers & their display tick
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#include <stdbool.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "short_types.h"
+#include "stopwatch.h"
+
+/*
+ * The elapsed time is always worked out from when a stopwatch was
+ * started, so it doesn't matter how late or how often the tick runs
+ * (a busy main loop, suspend etc), it's only there to update the
+ * display. The clock is CLOCK_BOOTTIME, which unlike the monotonic clock
+ * keeps counting while the machine is suspended, so a recording left
+ * running over a suspend includes it.
+ *
+ * There is a single tick source for all the running stopwatches, which
+ * only exists while at least one of them is running and there is
+ * something visible to update.
+ */
+static guint tick_id;
+static stopwatch_tick_fn tick_fn;
+static void *tick_data;
+static unsigned int nr_running;
+static bool tick_visible = true;
+
+/* Microseconds, as g_get_monotonic_time(), but counting suspend */
+static gint64 get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+
+	return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static gboolean tick(gpointer data __attribute__((unused)))
+{
+	tick_fn(tick_data);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void update_tick(void)
+{
+	bool want = tick_fn && nr_running > 0 && tick_visible;
+
+	if (want && !tick_id) {
+		tick_id = g_timeout_add_seconds(1, tick, NULL);
+	} else if (!want && tick_id) {
+		g_source_remove(tick_id);
+		tick_id = 0;
+	}
+}
+
+/* Start (or carry on) counting from the stopwatch's current value */
+void stopwatch_start(struct stopwatch *sw)
+{
+	if (sw->started)
+		return;
+
+	sw->started = get_time();
+	nr_running++;
+	update_tick();
+}
+
+void stopwatch_stop(struct stopwatch *sw)
+{
+	if (!sw->started)
+		return;
+
+	sw->base = stopwatch_elapsed(sw);
+	sw->started = 0;
+	nr_running--;
+	update_tick();
+}
+
+/* Set the stopwatch's value, if it's running it carries on from there */
+void stopwatch_set(struct stopwatch *sw, u32 seconds)
+{
+	sw->base = seconds;
+	if (sw->started)
+		sw->started = get_time();
+}
+
+u32 stopwatch_elapsed(const struct stopwatch *sw)
+{
+	if (!sw->started)
+		return sw->base;
+
+	return sw->base + (get_time() - sw->started) /
+		G_USEC_PER_SEC;
+}
+
+bool stopwatch_is_running(const struct stopwatch *sw)
+{
+	return sw->started != 0;
+}
+
+/* fn is called about once a second while any stopwatch is running */
+void stopwatch_set_tick(stopwatch_tick_fn fn, void *data)
+{
+	tick_fn = fn;
+	tick_data = data;
+	update_tick();
+}
+
+/*
+ * While not visible (e.g the window is hidden or minimised) there is no
+ * tick. Becoming visible again ticks straight away to catch up.
+ */
+void stopwatch_set_visible(bool visible)
+{
+	bool catch_up = visible && !tick_visible;
+
+	tick_visible = visible;
+	update_tick();
+
+	if (catch_up && tick_fn && nr_running > 0)
+		tick_fn(tick_data);
+}
@@ -0,0 +1,35 @@
+/*
+ * stopwatch.h - Boot time clock based timers & their display tick
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _STOPWATCH_H_
+#define _STOPWATCH_H_
+
+#include <stdbool.h>
+
+#include <glib.h>
+
+#include "short_types.h"
+
+struct stopwatch {
+	gint64 started;		/* CLOCK_BOOTTIME (us) started, 0 if stopped */
+	u32 base;		/* Seconds counted before started */
+};
+
+typedef void (*stopwatch_tick_fn)(void *data);
+
+extern void stopwatch_start(struct stopwatch *sw);
+extern void stopwatch_stop(struct stopwatch *sw);
+extern void stopwatch_set(struct stopwatch *sw, u32 seconds);
+extern u32 stopwatch_elapsed(const struct stopwatch *sw);
+extern bool stopwatch_is_running(const struct stopwatch *sw);
+
+extern void stopwatch_set_tick(stopwatch_tick_fn fn, void *data);
+extern void stopwatch_set_visible(bool visible);
+
+#endif /* _STOPWATCH_H_ */
@@ -1,11 +1,19 @@
 #include <stdio.h>
-#include <strings.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include <gtk/gtk.h>
 
 #include <sqlite3.h>
 
 #include "tempus.h"
+#include "db.h"
+#include "util.h"
+#include "stats.h"
+#include "date.h"
+#include "export.h"
 
 enum summaries_column {
 	COL_PERIOD = 0,
@@ -15,96 +23,496 @@ enum summaries_column {
 	COL_DURATION,
 };
 
-static void liststore_insert(GtkListStore *ls, const char *entity,
-			     const char *project, const char *sub_project,
-			     const char *start, const char *end, int duration)
+/* Column order of SQL_SUMMARIES */
+enum summaries_sql_column {
+	SUM_SQL_COL_FIRST_DATE = 0,
+	SUM_SQL_COL_LAST_DATE,
+	SUM_SQL_COL_ENTITY,
+	SUM_SQL_COL_PROJECT,
+	SUM_SQL_COL_SUB_PROJECT,
+	SUM_SQL_COL_DURATION
+};
+
+struct summary {
+	char *entity;
+	char *project;
+	char *sub_project;
+	char start[11];
+	char end[11];
+	int duration;
+};
+
+/*
+ * Summaries are read on the database thread and handed back to the
+ * main loop in batches, so the window fills in as the data is read.
+ *
+ * The job is shared between the database thread and any batches still
+ * waiting to be added, hence the reference count.
+ */
+struct summaries_job {
+	struct widgets *w;
+
+	gint ref;
+	gint cancelled;
+
+	/* Only touched by the database thread */
+	GPtrArray *summaries;
+	gint64 nr_rows;
+	gint64 rows_done;
+
+	/* < 0 for the overall totals, otherwise an enum rollup_period */
+	int period;
+	char from[11];
+	char to[11];
+};
+
+struct summaries_batch {
+	struct summaries_job *job;
+
+	GPtrArray *summaries;
+	double fraction;
+};
+
+/* Hand back to the main loop every this many summaries */
+#define SUMMARIES_BATCH		256
+
+static struct summaries_job *current_job;
+
+static void free_summary(gpointer data)
+{
+	struct summary *sum = data;
+
+	g_free(sum->entity);
+	g_free(sum->project);
+	g_free(sum->sub_project);
+	g_slice_free(struct summary, sum);
+}
+
+static void liststore_insert(GtkListStore *ls, const struct summary *sum)
 {
 	GtkTreeIter iter;
 	char period[32];
 	char dbuf[16];
 
-	if (!*start)
-		return;
-
-	snprintf(period, sizeof(period), "%s -- %s", start, end);
-	secs_to_dur(duration, dbuf, sizeof(dbuf), "%u:%02u:%02u");
+	if (strcmp(sum->start, sum->end) == 0)
+		snprintf(period, sizeof(period), "%s", sum->start);
+	else
+		snprintf(period, sizeof(period), "%s -- %s", sum->start,
+			 sum->end);
+	secs_to_dur(sum->duration, dbuf, sizeof(dbuf), "%u:%02u:%02u");
 
 	gtk_list_store_append(ls, &iter);
 	gtk_list_store_set(ls, &iter,
 			   COL_PERIOD, period,
-			   COL_ENTITY, entity,
-			   COL_PROJECT, project,
-			   COL_SUB_PROJECT, sub_project,
+			   COL_ENTITY, sum->entity,
+			   COL_PROJECT, sum->project,
+			   COL_SUB_PROJECT, sum->sub_project,
 			   COL_DURATION, dbuf,
 			   -1);
 }
 
-void do_summaries(struct widgets *w, const char *tempi_store)
+static void add_summary(GPtrArray *summaries, const char *entity,
+			const char *project, const char *sub_project,
+			const char *start, const char *end, int duration)
+{
+	struct summary *sum;
+
+	if (!start || !*start)
+		return;
+
+	sum = g_slice_new(struct summary);
+	sum->entity = g_strdup(entity);
+	sum->project = g_strdup(project);
+	sum->sub_project = g_strdup(sub_project);
+	snprintf(sum->start, sizeof(sum->start), "%s", start);
+	snprintf(sum->end, sizeof(sum->end), "%s", end);
+	sum->duration = duration;
+
+	g_ptr_array_add(summaries, sum);
+}
+
+static void summaries_job_unref(struct summaries_job *job)
+{
+	if (!g_atomic_int_dec_and_test(&job->ref))
+		return;
+
+	g_ptr_array_free(job->summaries, true);
+	g_slice_free(struct summaries_job, job);
+}
+
+static bool is_current_job(const struct summaries_job *job)
 {
+	return job == current_job && !g_atomic_int_get(&job->cancelled);
+}
+
+static void add_to_liststore(struct summaries_job *job, GPtrArray *summaries)
+{
+	u64 start = stats_begin();
+	guint i;
+
+	for (i = 0; i < summaries->len; i++)
+		liststore_insert(job->w->summaries_ls,
+				 g_ptr_array_index(summaries, i));
+
+	stats_end(STAT_SUMMARIES_FILL, start);
+}
+
+static gboolean summaries_batch_done(gpointer data)
+{
+	struct summaries_batch *batch = data;
+	struct summaries_job *job = batch->job;
+
+	if (is_current_job(job) && batch->fraction < 0) {
+		add_to_liststore(job, batch->summaries);
+		gtk_progress_bar_pulse(GTK_PROGRESS_BAR(job->w->sum_progress));
+	} else if (is_current_job(job)) {
+		char text[32];
+
+		add_to_liststore(job, batch->summaries);
+
+		snprintf(text, sizeof(text), "%.0f%%", batch->fraction * 100);
+		gtk_progress_bar_set_fraction(
+				GTK_PROGRESS_BAR(job->w->sum_progress),
+				batch->fraction);
+		gtk_progress_bar_set_text(
+				GTK_PROGRESS_BAR(job->w->sum_progress), text);
+	}
+
+	g_ptr_array_free(batch->summaries, true);
+	g_slice_free(struct summaries_batch, batch);
+	summaries_job_unref(job);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void post_batch(struct summaries_job *job)
+{
+	struct summaries_batch *batch = g_slice_new(struct summaries_batch);
+
+	batch->job = job;
+	batch->summaries = job->summaries;
+	/* We don't know how many rollups there are */
+	batch->fraction = job->nr_rows > 0 ?
+			  (double)job->rows_done / job->nr_rows : -1.0;
+
+	job->summaries = g_ptr_array_new_with_free_func(free_summary);
+
+	g_atomic_int_inc(&job->ref);
+	g_idle_add_full(G_PRIORITY_DEFAULT, summaries_batch_done, batch, NULL);
+}
+
+static void summaries_work(void *data)
+{
+	struct summaries_job *job = data;
 	sqlite3_stmt *stmt;
-	sqlite3 *db;
-	char sdate[11] = "\0";
-	char edate[11];
-	char last_entity[256] = "\0";
-	char last_project[256] = "\0";
-	char last_sub_project[256] = "\0";
-	int duration = 0;
-	const char *sql =
-		"SELECT * FROM tempus ORDER BY entity COLLATE NOCASE, "
-		"project COLLATE NOCASE, sub_project COLLATE NOCASE, date";
+	u64 start;
+
+	if (g_atomic_int_get(&job->cancelled))
+		return;
+
+	start = stats_begin();
+
+	if (job->period < 0 && !*job->from && !*job->to) {
+		/* Only used for the progress indication */
+		stmt = db_stmt(DB_STMT_SUMMARIES_COUNT);
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			job->nr_rows = sqlite3_column_int64(stmt, 0);
+		sqlite3_reset(stmt);
+
+		stmt = db_stmt(DB_STMT_SUMMARIES);
+	} else if (job->period < 0) {
+		stmt = db_stmt(DB_STMT_RANGE_TOTALS);
+		sqlite3_bind_text(stmt, 1, job->from, -1, NULL);
+		sqlite3_bind_text(stmt, 2, *job->to ? job->to : "9999-12-31",
+				  -1, NULL);
+	} else {
+		stmt = db_stmt(DB_STMT_ROLLUPS);
+		sqlite3_bind_int(stmt, 1, job->period);
+		sqlite3_bind_text(stmt, 2, job->from, -1, NULL);
+		sqlite3_bind_text(stmt, 3, *job->to ? job->to : "9999-12-31",
+				  -1, NULL);
+	}
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		if (g_atomic_int_get(&job->cancelled))
+			break;
+
+		if (job->summaries->len >= SUMMARIES_BATCH)
+			post_batch(job);
+		job->rows_done++;
+
+		add_summary(job->summaries,
+			    (char *)sqlite3_column_text(stmt,
+						SUM_SQL_COL_ENTITY),
+			    (char *)sqlite3_column_text(stmt,
+						SUM_SQL_COL_PROJECT),
+			    (char *)sqlite3_column_text(stmt,
+						SUM_SQL_COL_SUB_PROJECT),
+			    (char *)sqlite3_column_text(stmt,
+						SUM_SQL_COL_FIRST_DATE),
+			    (char *)sqlite3_column_text(stmt,
+						SUM_SQL_COL_LAST_DATE),
+			    sqlite3_column_int(stmt, SUM_SQL_COL_DURATION));
+	}
+	sqlite3_reset(stmt);
+
+	stats_count(STAT_SUMMARIES_ROWS, job->rows_done);
+	stats_end(STAT_SUMMARIES_QUERY, start);
+}
+
+static gboolean summaries_done(gpointer data)
+{
+	struct summaries_job *job = data;
+
+	if (is_current_job(job)) {
+		add_to_liststore(job, job->summaries);
+		gtk_widget_hide(job->w->sum_progress);
+		current_job = NULL;
+	}
+
+	summaries_job_unref(job);
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Abandon any summaries computation in progress, e.g when the window is
+ * closed. Anything it has yet to add to the window is discarded.
+ */
+void summaries_cancel(void)
+{
+	if (!current_job)
+		return;
+
+	g_atomic_int_set(&current_job->cancelled, 1);
+	current_job = NULL;
+}
+
+static void get_summaries_date(GtkWidget *entry, char *date, size_t len)
+{
+	const char *text = gtk_entry_get_text(GTK_ENTRY(entry));
+
+	if (is_valid_date(text))
+		snprintf(date, len, "%s", text);
+	else
+		*date = '\0';
+}
+
+void do_summaries(struct widgets *w)
+{
+	struct summaries_job *job = g_slice_new0(struct summaries_job);
+
+	summaries_cancel();
 
 	gtk_list_store_clear(w->summaries_ls);
 	/* Sort the list with the most recent entries at the top. */
 	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(w->summaries_tms),
 					     COL_PERIOD, GTK_SORT_DESCENDING);
+	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(w->sum_progress), 0.0);
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(w->sum_progress), NULL);
+	gtk_widget_show(w->sum_progress);
 	gtk_widget_show(w->sum_win);
 
-	sqlite3_open(tempi_store, &db);
-	sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+	job->w = w;
+	job->ref = 1;
+	/* The first entry is the overall totals, then the rollup periods */
+	job->period = gtk_combo_box_get_active(GTK_COMBO_BOX(w->sum_period)) -
+		      1;
+	get_summaries_date(w->sum_from, job->from, sizeof(job->from));
+	get_summaries_date(w->sum_to, job->to, sizeof(job->to));
+	job->summaries = g_ptr_array_new_with_free_func(free_summary);
+	current_job = job;
 
-	while (sqlite3_step(stmt) == SQLITE_ROW) {
-		const char *entity;
-		const char *project;
-		const char *sub_project;
-
-		entity = (char *)sqlite3_column_text(stmt, SQL_COL_ENTITY);
-		project = (char *)sqlite3_column_text(stmt, SQL_COL_PROJECT);
-		sub_project = (char *)sqlite3_column_text(stmt,
-							  SQL_COL_SUB_PROJECT);
-
-		if (!*sdate)
-			snprintf(sdate, sizeof(sdate), "%s",
-				 (char *)sqlite3_column_text(stmt,
-							     SQL_COL_DATE));
-		if ((*last_entity && strcasecmp(last_entity, entity) != 0) ||
-		    (*last_project &&
-		     strcasecmp(last_project, project) != 0) ||
-		    (*last_sub_project &&
-		     strcasecmp(last_sub_project, sub_project) != 0)) {
-			liststore_insert(w->summaries_ls, last_entity,
-					 last_project, last_sub_project, sdate,
-					 edate, duration);
-			duration = 0;
-			snprintf(sdate, sizeof(sdate), "%s",
-				 (char *)sqlite3_column_text(stmt,
-							     SQL_COL_DATE));
-		}
-		snprintf(edate, sizeof(edate), "%s",
-			 (char *)sqlite3_column_text(stmt, SQL_COL_DATE));
-		snprintf(last_entity, sizeof(last_entity), "%s", entity);
-		snprintf(last_project, sizeof(last_project), "%s", project);
-		snprintf(last_sub_project, sizeof(last_sub_project), "%s",
-			 sub_project);
-		duration += sqlite3_column_int(stmt, SQL_COL_DURATION);
+	db_submit(summaries_work, summaries_done, job);
+}
+
+struct export_job {
+	struct widgets *w;
+
+	char *path;
+	struct export_filter filter;
+	char *names[3];		/* What filter's names point to */
+	enum export_format format;
+	s64 nr_rows;
+};
+
+/* Written to a temporary file first so a failed export leaves nothing */
+static void export_work(void *data)
+{
+	struct export_job *job = data;
+	char *tmp = g_strconcat(job->path, ".tmp", NULL);
+	FILE *fp = fopen(tmp, "we");
+
+	job->nr_rows = -1;
+	if (!fp) {
+		fprintf(stderr, "Cannot create %s: %s\n", tmp,
+			strerror(errno));
+		goto out_free;
+	}
+
+	job->nr_rows = export_entries(db_stmt(DB_STMT_EXPORT), &job->filter,
+				      job->format, fp);
+	if (fclose(fp) != 0)
+		job->nr_rows = -1;
+	if (job->nr_rows >= 0 && rename(tmp, job->path) == -1) {
+		fprintf(stderr, "Cannot rename %s: %s\n", tmp,
+			strerror(errno));
+		job->nr_rows = -1;
+	}
+	if (job->nr_rows < 0)
+		unlink(tmp);
+
+out_free:
+	g_free(tmp);
+}
+
+static gboolean export_done(gpointer data)
+{
+	struct export_job *job = data;
+	GtkWidget *dialog;
+	int i;
+
+	if (job->nr_rows < 0)
+		dialog = gtk_message_dialog_new(GTK_WINDOW(job->w->sum_win),
+						GTK_DIALOG_MODAL,
+						GTK_MESSAGE_ERROR,
+						GTK_BUTTONS_CLOSE,
+						"Export to %s failed",
+						job->path);
+	else
+		dialog = gtk_message_dialog_new(GTK_WINDOW(job->w->sum_win),
+						GTK_DIALOG_MODAL,
+						GTK_MESSAGE_INFO,
+						GTK_BUTTONS_CLOSE,
+						"Exported %" G_GINT64_FORMAT
+						" entries to %s",
+						(gint64)job->nr_rows,
+						job->path);
+	gtk_dialog_run(GTK_DIALOG(dialog));
+	gtk_widget_destroy(dialog);
+
+	g_free(job->path);
+	for (i = 0; i < 3; i++)
+		g_free(job->names[i]);
+	g_slice_free(struct export_job, job);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void add_export_filter(GtkFileChooser *chooser, const char *name,
+			      enum export_format format)
+{
+	GtkFileFilter *filter = gtk_file_filter_new();
+	char pattern[16];
+
+	snprintf(pattern, sizeof(pattern), "*.%s", export_format_ext(format));
+	gtk_file_filter_set_name(filter, name);
+	gtk_file_filter_add_pattern(filter, pattern);
+	g_object_set_data(G_OBJECT(filter), "format", GINT_TO_POINTER(format));
+	gtk_file_chooser_add_filter(chooser, filter);
+}
+
+/*
+ * Entity, project & sub_project fields for the export dialog, names are
+ * set to the entries.
+ */
+static GtkWidget *export_names_grid(GtkWidget **names)
+{
+	static const char * const labels[] = {
+		"Entity:", "Project:", "Sub project:"
+	};
+	GtkWidget *grid = gtk_grid_new();
+	int i;
+
+	gtk_grid_set_row_spacing(GTK_GRID(grid), 6);
+	gtk_grid_set_column_spacing(GTK_GRID(grid), 6);
+	for (i = 0; i < 3; i++) {
+		GtkWidget *label = gtk_label_new(labels[i]);
+
+		gtk_widget_set_halign(label, GTK_ALIGN_END);
+		names[i] = gtk_entry_new();
+		gtk_entry_set_placeholder_text(GTK_ENTRY(names[i]), "Any");
+		gtk_grid_attach(GTK_GRID(grid), label, 0, i, 1, 1);
+		gtk_grid_attach(GTK_GRID(grid), names[i], 1, i, 1, 1);
+	}
+	gtk_widget_show_all(grid);
+
+	return grid;
+}
+
+/* What was typed into a name field, NULL (any) if nothing */
+static char *get_export_name(GtkWidget *entry)
+{
+	const char *name = gtk_entry_get_text(GTK_ENTRY(entry));
+
+	return *name ? g_strdup(name) : NULL;
+}
+
+/*
+ * Export the entries in the summaries window's date range, optionally
+ * only those of an entity, project and/or sub_project, in whichever
+ * format's file filter is chosen.
+ */
+void summaries_export(struct widgets *w)
+{
+	struct export_job *job;
+	GtkWidget *dialog;
+	GtkWidget *names[3];
+	GtkFileChooser *chooser;
+	GtkFileFilter *filter;
+	char *ext;
+	char *path;
+	char from[11];
+	char to[11];
+	int i;
+
+	dialog = gtk_file_chooser_dialog_new("Export entries",
+					     GTK_WINDOW(w->sum_win),
+					     GTK_FILE_CHOOSER_ACTION_SAVE,
+					     "_Cancel", GTK_RESPONSE_CANCEL,
+					     "_Export", GTK_RESPONSE_ACCEPT,
+					     NULL);
+	chooser = GTK_FILE_CHOOSER(dialog);
+	gtk_file_chooser_set_do_overwrite_confirmation(chooser, true);
+	add_export_filter(chooser, "CSV", EXPORT_CSV);
+	add_export_filter(chooser, "JSON Lines", EXPORT_JSONL);
+	add_export_filter(chooser, "iCalendar", EXPORT_ICAL);
+	gtk_file_chooser_set_current_name(chooser, "tempus.csv");
+	gtk_file_chooser_set_extra_widget(chooser, export_names_grid(names));
+
+	if (gtk_dialog_run(GTK_DIALOG(dialog)) != GTK_RESPONSE_ACCEPT) {
+		gtk_widget_destroy(dialog);
+		return;
+	}
+
+	job = g_slice_new0(struct export_job);
+	job->w = w;
+	filter = gtk_file_chooser_get_filter(chooser);
+	if (filter)
+		job->format = GPOINTER_TO_INT(g_object_get_data(
+					G_OBJECT(filter), "format"));
+	path = gtk_file_chooser_get_filename(chooser);
+	for (i = 0; i < 3; i++)
+		job->names[i] = get_export_name(names[i]);
+	gtk_widget_destroy(dialog);
+
+	/* Make sure it has the extension for the format */
+	ext = g_strconcat(".", export_format_ext(job->format), NULL);
+	if (g_str_has_suffix(path, ext)) {
+		job->path = path;
+	} else {
+		job->path = g_strconcat(path, ext, NULL);
+		g_free(path);
 	}
-	/*
-	 * Catch the last record (if there was one, or maybe it's
-	 * the _only_ one).
-	 */
-	liststore_insert(w->summaries_ls, last_entity, last_project,
-			 last_sub_project, sdate, edate, duration);
+	g_free(ext);
 
+	get_summaries_date(w->sum_from, from, sizeof(from));
+	get_summaries_date(w->sum_to, to, sizeof(to));
+	job->filter.from = *from ? date_to_day(from) : DATE_NONE;
+	job->filter.to = *to ? date_to_day(to) : DATE_MAX;
+	job->filter.entity = job->names[0];
+	job->filter.project = job->names[1];
+	job->filter.sub_project = job->names[2];
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	db_submit(export_work, export_done, job);
 }
@@ -3,6 +3,8 @@
 
 #include "tempus.h"
 
-extern void do_summaries(struct widgets *w, const char *tempi_store);
+extern void summaries_cancel(void);
+extern void do_summaries(struct widgets *w);
+extern void summaries_export(struct widgets *w);
 
 #endif /* _SUMMARIES_H_ */
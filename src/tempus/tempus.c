@@ -17,44 +17,114 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
 #include <time.h>
 #include <linux/limits.h>
 
 #include <sqlite3.h>
 
 #include <glib.h>
+#include <glib-unix.h>
 
 #include <gtk/gtk.h>
 
 #include "short_types.h"
 #include "tempus.h"
 #include "summaries.h"
+#include "search.h"
 #include "convert_db.h"
+#include "db.h"
+#include "util.h"
+#include "cli.h"
+#include "stats.h"
+#include "completion.h"
+#include "date.h"
+#include "stopwatch.h"
+#include "journal.h"
+#include "desc_cache.h"
+#include "snapshot.h"
+#include "ctl.h"
 
 #define APP_NAME	"Tempus"
+/* Compiled in from tempus.glade, see tempus.gresource.xml */
+#define UI_RESOURCE	"/net/digital-domain/tempus/tempus.glade"
 
 #define REC_BTN		"\342\217\272" /* U+23FA BLACK CIRCLE FOR RECORD */
 
-struct _data {
-	char *description;
+/* Formatted with $HOME */
+#define TEMPI_DIR	"%s/.local/share/tempus"
+/* Where the recording was journaled before tempusd held it */
+#define JOURNAL_FILE	TEMPI_DIR "/recording.journal"
+#define SNAPSHOT_FILE	TEMPI_DIR "/history.snapshot"
+
+enum timer_states { TIMER_STOPPED = 0, TIMER_RUNNING };
+
+struct tempi_row {
+	gint64 id;
+	int duration;
+	int day;
+	char *date;
+	char *entity;
+	char *project;
+	char *sub_project;
+	char *description;	/* Not loaded for the history */
+	bool has_description;
 };
 
-struct list_w {
-	int id;
+/* A page of the history */
+struct load_job {
+	struct widgets *w;
 
-	GtkWidget *hbox;
-	GtkWidget *date;
-	GtkWidget *company;
-	GtkWidget *project;
-	GtkWidget *sub_project;
-	GtkWidget *hours;
-	GtkWidget *description;
-	GtkWidget *edit;
+	GPtrArray *rows;
+	guint next;		/* Next of the rows to add to the list */
 
-	struct _data data;
+	int from;		/* Earliest day wanted */
+	int before_day;		/* Rows from before (day, id) */
+	gint64 before_id;
+	int limit;		/* -1 for no limit */
+	bool last;		/* No more pages follow it */
 };
 
-enum timer_states { TIMER_STOPPED = 0, TIMER_RUNNING };
+/* Checking the history snapshot against the database */
+struct snapshot_job {
+	struct widgets *w;
+
+	struct snapshot *snap;
+	bool valid;
+	GPtrArray *added;	/* struct tempi_row since it, newest first */
+};
+
+/* An entry being saved by tempusd */
+struct save_job {
+	struct widgets *w;
+
+	unsigned int form_gen;
+	guint timer_id;		/* Of the named timer saved, 0 for the form */
+	u64 start;
+};
+
+/* Fetching an entry's description for a tooltip or to edit it */
+struct desc_job {
+	struct widgets *w;
+
+	gint64 id;
+	char *desc;
+	unsigned int form_gen;	/* Of the edit, or 0 for a tooltip */
+};
+
+/*
+ * A timer of its own for an entity/project/sub_project, running
+ * alongside (and independently of) the one in the entry form.
+ */
+struct named_timer {
+	guint id;
+	struct stopwatch stopwatch;
+	char *entity;
+	char *project;
+	char *sub_project;
+	bool saving;
+};
 
 struct d_o_w {
 	const char *day_full;
@@ -74,269 +144,605 @@ static const struct d_o_w days_of_week[] = {
 
 /* Number of days to show history for */
 #define HISTORY_LIMIT	180
-
-/* Set this to the number of seconds past midnight a new day should start */
-static const int new_day_offset = 16200; /* 0430 */
+/* Rows fetched at a time for the history, after today's */
+#define HISTORY_PAGE_ROWS	500
+/* The most time spent adding to the history list before drawing a frame */
+#define HISTORY_FILL_BUDGET_US	5000
+/* How long the entry form is left alone before tempusd is sent it */
+#define EDIT_DELAY_MS		500
 
 static bool show_all;
+static int from_day = DATE_NONE;
+static int to_day = DATE_MAX;
 static bool unsaved_recording;
 static bool todays_date_hdr_displayed;
 static int timer_state = TIMER_STOPPED;
-static u32 elapsed_seconds;
-static GTree *tempi;
+static struct stopwatch stopwatch;
 static char tempi_store[PATH_MAX];
+static char journal_file[PATH_MAX];
+static char snapshot_file[PATH_MAX];
+/* Only the default history window is snapshot */
+static bool default_window;
+/* Of the snapshot the history was loaded from, if it was */
+static struct snapshot_key snapshot_key;
+static bool snapshot_loaded;
 static long long tempus_id = -1;
-static char last_date[11];	/* YYYY-MM-DD + '\0' */
+/* Bumped whenever the entry form is switched to a different entry */
+static unsigned int form_gen;
+static int last_day = DATE_NONE;	/* Of the top date header */
+static int history_day = DATE_NONE;	/* Of the last row loaded */
+/* Until today's entries have been loaded */
+static u64 startup_start;
+/* NULL until the completions have been loaded */
+static struct completion *completion;
+/*
+ * The recording (the entry form, while it's unsaved) is held by tempusd,
+ * it's sent the form as it changes, once it's been left alone for a bit.
+ */
+static struct ctl_conn *ctl;
+static guint edit_timeout_id;
+static guint reconnect_id;
+/* Filling in the form from tempusd, rather than it being edited */
+static bool applying_status;
+/* struct named_timer, in the order they're listed */
+static GPtrArray *timers;
+static guint last_timer_id;
+
+/* The most completions offered at once */
+#define COMPLETION_MAX		10
+
+static const struct option long_opts[] = {
+	{ "stats",	no_argument,		NULL, 's' },
+	{ NULL,		0,			NULL, 0 }
+};
 
 static void disp_usage(void)
 {
-	printf("Usage: tempus [-a]\n\n");
-	printf("Pass -a to show all log entries. Otherwise only the last 90 "
-			"days are shown.\n");
+	printf("Usage: tempus [-a] [-f YYYY-MM-DD] [-t YYYY-MM-DD] "
+			"[-s|--stats]\n\n");
+	printf("Pass -a to show all log entries. Otherwise only the last %d "
+			"days are shown.\n", HISTORY_LIMIT);
+	printf("Pass -f and/or -t to only show log entries from and/or to "
+			"the given dates.\n");
+	printf("Pass -s (or set " STATS_ENV ") to print timings on exit, or "
+			"on SIGUSR1.\n\n");
+	printf("The recording is held by tempusd, which is started if need "
+			"be.\n\n");
+	printf("Or without the GUI:\n\n");
+	printf("  tempus list [--since YYYY-MM-DD] [--until YYYY-MM-DD]\n");
+	printf("  tempus report [--period day|week|month] "
+			"[--from YYYY-MM-DD] [--to YYYY-MM-DD]\n");
+	printf("  tempus total [--entity NAME] [--project NAME] "
+			"[--sub-project NAME]\n"
+	       "               [--from YYYY-MM-DD] [--to YYYY-MM-DD] "
+			"[--seconds]\n");
+	printf("\nOr to control the recording, see tempusctl.\n");
+}
+
+/*
+ * Set the default start of the history window, HISTORY_LIMIT days ago,
+ * unless we are showing everything or were given a from date.
+ */
+static void set_history_window(void)
+{
+	if (show_all || from_day != DATE_NONE)
+		return;
+
+	from_day = date_today() - HISTORY_LIMIT;
+	default_window = to_day == DATE_MAX;
 }
 
 static void update_elapased_seconds(const struct widgets *w)
 {
-	elapsed_seconds =
+	stopwatch_set(&stopwatch,
 		gtk_spin_button_get_value(GTK_SPIN_BUTTON(w->hours)) * 3600 +
 		gtk_spin_button_get_value(GTK_SPIN_BUTTON(w->minutes)) * 60 +
-		gtk_spin_button_get_value(GTK_SPIN_BUTTON(w->seconds));
+		gtk_spin_button_get_value(GTK_SPIN_BUTTON(w->seconds)));
 }
 
-static int int_cmp(gconstpointer a, gconstpointer b,
-		   gpointer user_data __attribute__((unused)))
+static const char *get_day_of_week_abr(int day)
 {
-	long aa = GPOINTER_TO_INT(a);
-	long bb = GPOINTER_TO_INT(b);
+	return days_of_week[date_day_of_week(day)].day_abr;
+}
 
-	if (aa < bb)
-		return -1;
-	else if (aa > bb)
-		return 1;
+static bool is_today(int day)
+{
+	return day == date_today();
+}
 
-	return 0;
+static bool override_unsaved_recording(struct widgets *w)
+{
+	int ret = true;
+
+	if (unsaved_recording) {
+		int response = gtk_dialog_run(GTK_DIALOG(w->dialog));
+
+		if (response == GTK_RESPONSE_CANCEL)
+			ret = false;
+
+		gtk_widget_hide(w->dialog);
+	}
+
+	return ret;
+}
+
+static void clear_tempi_row(struct tempi_row *row)
+{
+	g_free(row->date);
+	g_free(row->entity);
+	g_free(row->project);
+	g_free(row->sub_project);
+	g_free(row->description);
 }
 
-static void seconds_to_hms(int seconds, u32 *h, u32 *m, u32 *s)
+static void free_tempi_row(gpointer data)
 {
-	u32 secs = seconds;
+	struct tempi_row *row = data;
 
-	*s = secs % 60;
-	secs /= 60;
-	*m = secs % 60;
-	*h = secs / 60;
+	clear_tempi_row(row);
+	g_slice_free(struct tempi_row, row);
 }
 
-char *secs_to_dur(int seconds, char *buf, size_t len, const char *format)
+static void update_window_title(struct widgets *w)
 {
-	u32 secs;
+	u32 hours;
 	u32 minutes;
+	u32 seconds;
+	char title[128];
+
+	seconds_to_hms(stopwatch_elapsed(&stopwatch), &hours, &minutes,
+		       &seconds);
+
+	snprintf(title, sizeof(title), "%s%s [%s%02u:%02u:%02u - %s / %s / %s]",
+			(timer_state == TIMER_RUNNING) ? REC_BTN: "", APP_NAME,
+			(timer_state == TIMER_RUNNING) ? "Rec - " : "",
+			hours, minutes, seconds,
+			gtk_entry_get_text(GTK_ENTRY(w->company)),
+			gtk_entry_get_text(GTK_ENTRY(w->project)),
+			gtk_entry_get_text(GTK_ENTRY(w->sub_project)));
+
+	gtk_window_set_title(GTK_WINDOW(w->window), title);
+}
+
+static void update_timer_display(struct widgets *w)
+{
 	u32 hours;
-	const char *fmt = format ? format : "%02u:%02u:%02u";
+	u32 minutes;
+	u32 seconds;
+
+	seconds_to_hms(stopwatch_elapsed(&stopwatch), &hours, &minutes,
+		       &seconds);
 
-	seconds_to_hms(seconds, &hours, &minutes, &secs);
-	snprintf(buf, len, fmt, hours, minutes, secs);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->seconds), seconds);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->minutes), minutes);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->hours), hours);
 
-	return buf;
+	update_window_title(w);
 }
 
-static const char *get_day_of_week_abr(const char *date)
+static gboolean cb_window_state(GtkWidget *window __attribute__((unused)),
+				GdkEventWindowState *event,
+				gpointer data __attribute__((unused)))
 {
-	GTimeZone *tz = g_time_zone_new_local();
-	GDateTime *dt = g_date_time_new(tz, atoi(date), atoi(date+5),
-			atoi(date+8), 0, 0, 0.0);
+	stopwatch_set_visible(!(event->new_window_state &
+				(GDK_WINDOW_STATE_ICONIFIED |
+				 GDK_WINDOW_STATE_WITHDRAWN)));
 
-	return days_of_week[g_date_time_get_day_of_week(dt)].day_abr;
+	return false;
 }
 
-static bool is_today(const char *date)
+static void set_entry_text(GtkWidget *entry, const char *text)
 {
-	time_t now = time(NULL) - new_day_offset;
-	struct tm *tm = localtime(&now);
-	struct tm then;
+	if (strcmp(gtk_entry_get_text(GTK_ENTRY(entry)), text) != 0)
+		gtk_entry_set_text(GTK_ENTRY(entry), text);
+}
 
-	memset(&then, 0, sizeof(struct tm));
-	strptime(date, "%F", &then);
+/* The form's description, to be g_free()'d */
+static char *get_description(struct widgets *w)
+{
+	GtkTextBuffer *desc_buf;
+	GtkTextIter start;
+	GtkTextIter end;
 
-	if (then.tm_year != tm->tm_year ||
-	    then.tm_mon != tm->tm_mon ||
-	    then.tm_mday != tm->tm_mday)
-		return false;
+	desc_buf = gtk_text_view_get_buffer(GTK_TEXT_VIEW(w->description));
+	gtk_text_buffer_get_start_iter(desc_buf, &start);
+	gtk_text_buffer_get_end_iter(desc_buf, &end);
 
-	return true;
+	return gtk_text_buffer_get_text(desc_buf, &start, &end, true);
 }
 
-static bool entry_show(const char *date)
+static void set_description(struct widgets *w, const char *desc)
 {
-	GDate *today;
-	GDate *then;
-	struct tm tm;
-	int days;
-	bool ret = true;
+	GtkTextBuffer *desc_buf;
+	char *old = get_description(w);
 
-	memset(&tm, 0, sizeof(struct tm));
-	strptime(date, "%F", &tm);
+	desc_buf = gtk_text_view_get_buffer(GTK_TEXT_VIEW(w->description));
+	if (strcmp(old, desc) != 0)
+		gtk_text_buffer_set_text(desc_buf, desc, -1);
+	g_free(old);
+}
 
-	today = g_date_new();
-	g_date_set_time_t(today, time(NULL));
-	then = g_date_new_dmy(tm.tm_mday, tm.tm_mon + 1, tm.tm_year + 1900);
+static void set_timer_state(struct widgets *w, bool running)
+{
+	timer_state = running ? TIMER_RUNNING : TIMER_STOPPED;
 
-	days = g_date_days_between(then, today);
-	/* Don't show log entries older than HISTORY_LIMIT days */
-	if (days > HISTORY_LIMIT)
-		ret = false;
+	gtk_editable_set_editable(GTK_EDITABLE(w->hours), !running);
+	gtk_editable_set_editable(GTK_EDITABLE(w->minutes), !running);
+	gtk_editable_set_editable(GTK_EDITABLE(w->seconds), !running);
 
-	g_date_free(today);
-	g_date_free(then);
+	gtk_widget_set_sensitive(w->start, !running);
+	gtk_widget_set_sensitive(w->stop, running);
+	gtk_widget_set_sensitive(w->save, !running);
+	gtk_widget_set_sensitive(w->new, !running);
+}
 
-	return ret;
+/* Back to an empty form, for a new entry */
+static void clear_form(struct widgets *w)
+{
+	form_gen++;
+
+	gtk_widget_set_sensitive(w->save, false);
+	gtk_widget_set_sensitive(w->new, false);
+
+	gtk_entry_set_text(GTK_ENTRY(w->company), "");
+	gtk_entry_set_text(GTK_ENTRY(w->project), "");
+	gtk_entry_set_text(GTK_ENTRY(w->sub_project), "");
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->hours), 0.0);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->minutes), 0.0);
+	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->seconds), 0.0);
+	set_description(w, "");
+
+	stopwatch_set(&stopwatch, 0);
+	tempus_id = -1;
+	update_window_title(w);
 }
 
-static bool override_unsaved_recording(struct widgets *w)
+/*
+ * Show the recording as tempusd has it, from the fields after OK or EV
+ * (see status_fields() in tempusd.c). Unless form is true, or it's a
+ * recording the form wasn't showing, only its state & time are taken,
+ * as the form is what was sent. Either way, anything typed since that's
+ * yet to be sent is kept.
+ */
+static void apply_status(struct widgets *w, char **fields, bool form)
 {
-	int ret = true;
+	bool running;
 
-	if (unsaved_recording) {
-		int response = gtk_dialog_run(GTK_DIALOG(w->dialog));
+	if (strcmp(fields[0], "idle") == 0) {
+		if (!unsaved_recording)
+			return;
 
-		if (response == GTK_RESPONSE_CANCEL)
-			ret = false;
+		/* Saved or thrown away, from elsewhere */
+		unsaved_recording = false;
+		stopwatch_stop(&stopwatch);
+		set_timer_state(w, false);
+		clear_form(w);
+		return;
+	}
 
-		gtk_widget_hide(w->dialog);
+	if (g_strv_length(fields) < 7)
+		return;
+
+	if (!unsaved_recording) {
+		form_gen++;
+		form = true;
+	}
+	if (form && !edit_timeout_id) {
+		applying_status = true;
+		set_entry_text(w->company, fields[2]);
+		set_entry_text(w->project, fields[3]);
+		set_entry_text(w->sub_project, fields[4]);
+		set_description(w, fields[6]);
+		tempus_id = g_ascii_strtoll(fields[5], NULL, 10);
+		applying_status = false;
 	}
 
-	return ret;
+	running = strcmp(fields[0], "running") == 0;
+	if (running) {
+		stopwatch_set(&stopwatch, atoi(fields[1]));
+		stopwatch_start(&stopwatch);
+	} else {
+		stopwatch_stop(&stopwatch);
+		stopwatch_set(&stopwatch, atoi(fields[1]));
+	}
+	set_timer_state(w, running);
+	unsaved_recording = true;
+
+	update_timer_display(w);
 }
 
-static void free_lw(gpointer data)
+/* Send word & the NULL terminated args to tempusd, fn gets the reply */
+static void ctl_send(const char *word, const char * const *args,
+		     ctl_reply_fn fn, void *data)
 {
-	struct list_w *lw = data;
+	char *line = ctl_join(word, args);
 
-	gtk_widget_destroy(lw->hbox);
-	free(lw->data.description);
-	free(lw);
+	ctl_conn_send(ctl, line, fn, data);
+	g_free(line);
 }
 
-static void update_window_title(struct widgets *w)
+/* Fill the form back in from tempusd, after it's told us something's up */
+static void cb_status_resync(char **fields, void *data)
 {
-	u32 hours;
-	u32 minutes;
-	u32 seconds;
-	char title[128];
+	struct widgets *w = data;
 
-	seconds_to_hms(elapsed_seconds, &hours, &minutes, &seconds);
+	if (!fields)
+		return;
 
-	snprintf(title, sizeof(title), "%s%s [%s%02u:%02u:%02u - %s / %s / %s]",
-			(timer_state == TIMER_RUNNING) ? REC_BTN: "", APP_NAME,
-			(timer_state == TIMER_RUNNING) ? "Rec - " : "",
-			hours, minutes, seconds,
-			gtk_entry_get_text(GTK_ENTRY(w->company)),
-			gtk_entry_get_text(GTK_ENTRY(w->project)),
-			gtk_entry_get_text(GTK_ENTRY(w->sub_project)));
+	if (strcmp(fields[0], "OK") != 0) {
+		fprintf(stderr, "tempusd: %s\n",
+			fields[1] ? fields[1] : "Bad reply");
+		ctl_send("status", NULL, cb_status_resync, w);
+		return;
+	}
 
-	gtk_window_set_title(GTK_WINDOW(w->window), title);
+	apply_status(w, fields + 1, true);
 }
 
-static gboolean do_timer(struct widgets *w)
+/*
+ * The form is already as wanted, only the recording's state is taken.
+ * Unless it's since been saved or thrown away.
+ */
+static void cb_status_reply(char **fields, void *data)
 {
-	u32 hours;
-	u32 minutes;
-	u32 seconds;
+	struct widgets *w = data;
 
-	if (timer_state == TIMER_STOPPED) {
-		update_window_title(w);
-		return false;
+	if (!fields || !unsaved_recording)
+		return;
+
+	if (strcmp(fields[0], "OK") != 0) {
+		cb_status_resync(fields, w);
+		return;
 	}
 
-	elapsed_seconds++;
+	apply_status(w, fields + 1, false);
+}
 
-	seconds_to_hms(elapsed_seconds, &hours, &minutes, &seconds);
+/*
+ * with_secs sets the recording's seconds, otherwise they're left be,
+ * fn gets the reply.
+ */
+static void send_edit(struct widgets *w, bool with_secs, ctl_reply_fn fn)
+{
+	const char *args[7];
+	char id[24];
+	char secs[16] = "";
+	char *desc = get_description(w);
+
+	if (edit_timeout_id)
+		g_source_remove(edit_timeout_id);
+	edit_timeout_id = 0;
+
+	snprintf(id, sizeof(id), "%lld", tempus_id);
+	if (with_secs)
+		snprintf(secs, sizeof(secs), "%u",
+			 stopwatch_elapsed(&stopwatch));
+
+	args[0] = id;
+	args[1] = secs;
+	args[2] = gtk_entry_get_text(GTK_ENTRY(w->company));
+	args[3] = gtk_entry_get_text(GTK_ENTRY(w->project));
+	args[4] = gtk_entry_get_text(GTK_ENTRY(w->sub_project));
+	args[5] = desc;
+	args[6] = NULL;
+
+	ctl_send("edit", args, fn, w);
+
+	g_free(desc);
+}
 
-	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->seconds), seconds);
-	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->minutes), minutes);
-	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->hours), hours);
+static gboolean cb_edit_timeout(gpointer data)
+{
+	edit_timeout_id = 0;
+	send_edit(data, false, cb_status_reply);
 
-	update_window_title(w);
+	return G_SOURCE_REMOVE;
+}
+
+/* An unsaved recording is sent to tempusd once it's left alone */
+static void form_changed(struct widgets *w)
+{
+	if (applying_status || !unsaved_recording)
+		return;
+
+	if (edit_timeout_id)
+		g_source_remove(edit_timeout_id);
+	edit_timeout_id = g_timeout_add(EDIT_DELAY_MS, cb_edit_timeout, w);
+}
+
+static void cb_desc_changed(GtkTextBuffer *buf __attribute__((unused)),
+			    struct widgets *w)
+{
+	form_changed(w);
+}
 
-	return true;
+static void cb_name_changed(GtkEditable *editable __attribute__((unused)),
+			    struct widgets *w)
+{
+	form_changed(w);
 }
 
+/*
+ * If there's a journal left from a recording that was never saved
+ * (before tempusd held it), offer to carry on with it.
+ */
+/* Only once tempusd has the recording is the old journal done with */
+static void cb_restored(char **fields, void *data)
+{
+	if (fields && strcmp(fields[0], "OK") == 0)
+		unlink(journal_file);
+
+	cb_status_reply(fields, data);
+}
+
+static void restore_recording(struct widgets *w)
+{
+	struct journal_state state;
+	GtkWidget *dialog;
+	char dur[16];
+	int response;
+
+	if (journal_read(journal_file, &state) == -1)
+		goto out_clear;
+
+	dialog = gtk_message_dialog_new(GTK_WINDOW(w->window),
+					GTK_DIALOG_MODAL,
+					GTK_MESSAGE_QUESTION,
+					GTK_BUTTONS_YES_NO,
+					"Restore the unsaved recording?");
+	gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dialog),
+			"%s / %s / %s (%s)",
+			state.names[JOURNAL_ENTITY],
+			state.names[JOURNAL_PROJECT],
+			state.names[JOURNAL_SUB_PROJECT],
+			secs_to_dur(state.elapsed, dur, sizeof(dur), NULL));
+	response = gtk_dialog_run(GTK_DIALOG(dialog));
+	gtk_widget_destroy(dialog);
+
+	if (response != GTK_RESPONSE_YES) {
+		unlink(journal_file);
+		goto out_clear;
+	}
+
+	form_gen++;
+	/* Entries can only be edited on the day they were recorded */
+	tempus_id = state.day == date_today() ? state.id : -1;
+
+	gtk_entry_set_text(GTK_ENTRY(w->company),
+			   state.names[JOURNAL_ENTITY]);
+	gtk_entry_set_text(GTK_ENTRY(w->project),
+			   state.names[JOURNAL_PROJECT]);
+	gtk_entry_set_text(GTK_ENTRY(w->sub_project),
+			   state.names[JOURNAL_SUB_PROJECT]);
+	set_description(w, state.description->str);
+
+	stopwatch_set(&stopwatch, state.elapsed);
+	update_timer_display(w);
+
+	unsaved_recording = true;
+	gtk_widget_set_sensitive(w->save, true);
+	gtk_widget_set_sensitive(w->new, true);
+
+	/* tempusd journals it from here on, once it's taken it */
+	send_edit(w, true, cb_restored);
+
+out_clear:
+	journal_state_clear(&state);
+}
+
+static bool have_unsaved_timers(void)
+{
+	guint i;
+
+	for (i = 0; i < timers->len; i++) {
+		const struct named_timer *t = g_ptr_array_index(timers, i);
+
+		if (stopwatch_elapsed(&t->stopwatch) > 0)
+			return true;
+	}
+
+	return false;
+}
+
+/* The entry form's recording is kept by tempusd, only ask about timers */
 void cb_quit(GtkButton *button __attribute__((unused)), struct widgets *w)
 {
-	if (override_unsaved_recording(w))
+	bool quit = true;
+
+	if (have_unsaved_timers()) {
+		quit = gtk_dialog_run(GTK_DIALOG(w->dialog)) !=
+			GTK_RESPONSE_CANCEL;
+		gtk_widget_hide(w->dialog);
+	}
+
+	if (quit)
 		gtk_main_quit();
 }
 
 static void cb_stop_timer(GtkButton *button __attribute__((unused)),
 			  struct widgets *w)
 {
-	timer_state = TIMER_STOPPED;
-
-	gtk_widget_set_sensitive(w->start, true);
-	gtk_widget_set_sensitive(w->stop, false);
-	gtk_widget_set_sensitive(w->save, true);
-	gtk_widget_set_sensitive(w->new, true);
+	stopwatch_stop(&stopwatch);
+	set_timer_state(w, false);
+	update_timer_display(w);
 
-	gtk_editable_set_editable(GTK_EDITABLE(w->hours), true);
-	gtk_editable_set_editable(GTK_EDITABLE(w->minutes), true);
-	gtk_editable_set_editable(GTK_EDITABLE(w->seconds), true);
+	/* Shows exactly what was recorded, once it's replied */
+	ctl_send("pause", NULL, cb_status_reply, w);
 }
 
 static void cb_start_timer(GtkButton *button __attribute__((unused)),
 			   struct widgets *w)
 {
-	timer_state = TIMER_RUNNING;
-	g_timeout_add(1000, (GSourceFunc)do_timer, w);
-
 	/* Take into account a possibly adjusted value */
 	update_elapased_seconds(w);
 
-	gtk_editable_set_editable(GTK_EDITABLE(w->hours), false);
-	gtk_editable_set_editable(GTK_EDITABLE(w->minutes), false);
-	gtk_editable_set_editable(GTK_EDITABLE(w->seconds), false);
+	send_edit(w, true, cb_status_reply);
+	ctl_send("start", NULL, cb_status_reply, w);
 
-	gtk_widget_set_sensitive(w->start, false);
-	gtk_widget_set_sensitive(w->stop, true);
-	gtk_widget_set_sensitive(w->save, false);
-	gtk_widget_set_sensitive(w->new, false);
+	stopwatch_start(&stopwatch);
+	set_timer_state(w, true);
 
 	unsaved_recording = true;
 }
 
-static void cb_edit(GtkButton *button, struct widgets *w)
+/*
+ * Editable (i.e today's) entries are always at the top of the list,
+ * so we only need to look as far as the first non-editable one.
+ */
+static bool find_editable_row(struct widgets *w, gint64 id,
+			      GtkTreeIter *iter)
 {
-	const char *s_id = gtk_widget_get_name(GTK_WIDGET(button));
-	struct list_w *lw;
-	const char *time_str;
-	GtkTextBuffer *desc_buf;
+	GtkTreeModel *model = GTK_TREE_MODEL(w->tempi_ls);
+	gboolean valid = gtk_tree_model_get_iter_first(model, iter);
+
+	while (valid) {
+		gint64 row_id;
+		gboolean editable;
+
+		gtk_tree_model_get(model, iter, TEMPI_COL_ID, &row_id,
+				   TEMPI_COL_EDITABLE, &editable, -1);
+		if (row_id == id)
+			return true;
+		if (row_id != -1 && !editable)
+			break;
+
+		valid = gtk_tree_model_iter_next(model, iter);
+	}
+
+	return false;
+}
+
+/* Fill in the entry form with the history row at iter */
+static void edit_entry(struct widgets *w, GtkTreeIter *iter, const char *desc)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(w->tempi_ls);
+	gint64 id;
+	char *company;
+	char *project;
+	char *sub_project;
+	char *time_str;
 	int hours;
 	int minutes;
 	int seconds;
 
-	if (!override_unsaved_recording(w))
-		return;
-
-	unsaved_recording = false;
-
 	gtk_widget_set_sensitive(w->save, false);
 	gtk_widget_set_sensitive(w->new, true);
 
-	tempus_id = atol(s_id);
-	lw = g_tree_lookup(tempi, GINT_TO_POINTER(tempus_id));
+	gtk_tree_model_get(model, iter,
+			   TEMPI_COL_ID, &id,
+			   TEMPI_COL_COMPANY, &company,
+			   TEMPI_COL_PROJECT, &project,
+			   TEMPI_COL_SUB_PROJECT, &sub_project,
+			   TEMPI_COL_DURATION, &time_str,
+			   -1);
+	tempus_id = id;
 
-	gtk_entry_set_text(GTK_ENTRY(w->company), gtk_entry_get_text(
-				GTK_ENTRY(lw->company)));
-	gtk_entry_set_text(GTK_ENTRY(w->project), gtk_entry_get_text(
-				GTK_ENTRY(lw->project)));
-	gtk_entry_set_text(GTK_ENTRY(w->sub_project), gtk_entry_get_text(
-				GTK_ENTRY(lw->sub_project)));
+	gtk_entry_set_text(GTK_ENTRY(w->company), company);
+	gtk_entry_set_text(GTK_ENTRY(w->project), project);
+	gtk_entry_set_text(GTK_ENTRY(w->sub_project), sub_project);
 
-	desc_buf = gtk_text_buffer_new(NULL);
-	gtk_text_buffer_set_text(desc_buf, (lw->data.description) ?
-			lw->data.description : "\0", -1);
-	gtk_text_view_set_buffer(GTK_TEXT_VIEW(w->description), desc_buf);
+	set_description(w, desc ? desc : "");
 
-	time_str = gtk_entry_get_text(GTK_ENTRY(lw->hours));
 	hours = atoi(time_str);
 	minutes = atoi(time_str + 3);
 	seconds = atoi(time_str + 6);
@@ -345,259 +751,643 @@ static void cb_edit(GtkButton *button, struct widgets *w)
 	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->minutes), minutes);
 	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->seconds), seconds);
 
-	elapsed_seconds = hours*3600 + minutes*60 + seconds;
+	stopwatch_set(&stopwatch, hours*3600 + minutes*60 + seconds);
 	update_window_title(w);
+
+	/* The timer carries on running for this entry */
+	if (timer_state == TIMER_RUNNING) {
+		unsaved_recording = true;
+		send_edit(w, true, cb_status_reply);
+	}
+
+	g_free(company);
+	g_free(project);
+	g_free(sub_project);
+	g_free(time_str);
+}
+
+static void fetch_desc_work(void *data)
+{
+	struct desc_job *job = data;
+	sqlite3_stmt *stmt = db_stmt(DB_STMT_DESCRIPTION);
+
+	sqlite3_bind_int64(stmt, 1, job->id);
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		job->desc = g_strdup((char *)sqlite3_column_text(stmt, 0));
+	sqlite3_reset(stmt);
+}
+
+/* The id of the description being fetched for a tooltip, if any */
+static gint64 tooltip_fetch_id = -1;
+
+static gboolean fetch_desc_done(gpointer data)
+{
+	struct desc_job *job = data;
+	struct widgets *w = job->w;
+	GtkTreeIter iter;
+
+	desc_cache_insert(job->id, job->desc);
+
+	if (!job->form_gen) {
+		if (job->id == tooltip_fetch_id)
+			tooltip_fetch_id = -1;
+		/* Have another go at showing it */
+		gtk_widget_trigger_tooltip_query(w->list_view);
+	} else if (job->form_gen == form_gen &&
+		   find_editable_row(w, job->id, &iter)) {
+		edit_entry(w, &iter, job->desc);
+	}
+
+	g_free(job->desc);
+	g_slice_free(struct desc_job, job);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* form_gen is that of the edit it's wanted for, 0 for a tooltip */
+static void fetch_desc(struct widgets *w, gint64 id, unsigned int gen)
+{
+	struct desc_job *job = g_slice_new0(struct desc_job);
+
+	job->w = w;
+	job->id = id;
+	job->form_gen = gen;
+
+	db_submit(fetch_desc_work, fetch_desc_done, job);
+}
+
+static void cb_edit(GtkTreeView *tree_view, GtkTreePath *path,
+		    GtkTreeViewColumn *column __attribute__((unused)),
+		    struct widgets *w)
+{
+	GtkTreeModel *model = gtk_tree_view_get_model(tree_view);
+	GtkTreeIter iter;
+	gboolean editable;
+	gboolean has_desc;
+	gint64 id;
+	const char *desc = NULL;
+
+	if (!gtk_tree_model_get_iter(model, &iter, path))
+		return;
+
+	/* Only today's entries can be edited */
+	gtk_tree_model_get(model, &iter, TEMPI_COL_EDITABLE, &editable, -1);
+	if (!editable)
+		return;
+
+	if (!override_unsaved_recording(w))
+		return;
+
+	/* A running one carries on, for this entry */
+	if (unsaved_recording && timer_state == TIMER_STOPPED)
+		ctl_send("discard", NULL, cb_status_reply, w);
+	if (edit_timeout_id)
+		g_source_remove(edit_timeout_id);
+	edit_timeout_id = 0;
+	unsaved_recording = false;
+	form_gen++;
+
+	gtk_tree_model_get(model, &iter,
+			   TEMPI_COL_ID, &id,
+			   TEMPI_COL_HAS_DESCRIPTION, &has_desc,
+			   -1);
+
+	/* Otherwise it's edited once the description has been fetched */
+	if (!has_desc || desc_cache_lookup(id, &desc))
+		edit_entry(w, &iter, desc);
+	else
+		fetch_desc(w, id, form_gen);
+}
+
+static gboolean cb_query_tooltip(GtkWidget *widget, gint x, gint y,
+				 gboolean keyboard_mode, GtkTooltip *tooltip,
+				 struct widgets *w)
+{
+	GtkTreeView *tree_view = GTK_TREE_VIEW(widget);
+	GtkTreeModel *model;
+	GtkTreePath *path;
+	GtkTreeIter iter;
+	gboolean has_desc;
+	gint64 id;
+	const char *desc;
+	bool ret = false;
+
+	if (!gtk_tree_view_get_tooltip_context(tree_view, &x, &y,
+					       keyboard_mode, &model, &path,
+					       &iter))
+		return false;
+
+	gtk_tree_model_get(model, &iter,
+			   TEMPI_COL_ID, &id,
+			   TEMPI_COL_HAS_DESCRIPTION, &has_desc,
+			   -1);
+	if (!has_desc)
+		goto out_free;
+
+	if (desc_cache_lookup(id, &desc)) {
+		if (desc) {
+			gtk_tooltip_set_text(tooltip, desc);
+			gtk_tree_view_set_tooltip_row(tree_view, tooltip,
+						      path);
+			ret = true;
+		}
+	} else if (id != tooltip_fetch_id) {
+		/* The tooltip is queried again once it's been fetched */
+		tooltip_fetch_id = id;
+		fetch_desc(w, id, 0);
+	}
+
+out_free:
+	gtk_tree_path_free(path);
+
+	return ret;
+}
+
+static void cb_new(GtkButton *button __attribute__((unused)),
+		   struct widgets *w)
+{
+	if (!override_unsaved_recording(w))
+		return;
+
+	if (unsaved_recording)
+		ctl_send("discard", NULL, cb_status_reply, w);
+	if (edit_timeout_id)
+		g_source_remove(edit_timeout_id);
+	edit_timeout_id = 0;
+	unsaved_recording = false;
+
+	clear_form(w);
+}
+
+static void add_date_hdr(struct widgets *w, const char *date, int day,
+			 bool prepend)
+{
+	GtkTreeIter iter;
+	const char *dow = get_day_of_week_abr(day);
+	char *markup;
+	u64 start = stats_begin();
+
+	if (is_today(day)) {
+		const char *date_fmt = "<span weight=\"bold\">\%s</span> <span size=\"small\">(\%s)</span>";
+
+		markup = g_markup_printf_escaped(date_fmt, date, dow);
+
+		todays_date_hdr_displayed = true;
+	} else {
+		const char *date_fmt = "\%s <span size=\"small\">(\%s)</span>";
+
+		markup = g_markup_printf_escaped(date_fmt, date, dow);
+	}
+
+	gtk_list_store_insert_with_values(w->tempi_ls, &iter,
+					  prepend ? 0 : -1,
+					  TEMPI_COL_ID, (gint64)-1,
+					  TEMPI_COL_DATE_HDR, markup,
+					  TEMPI_COL_EDITABLE, false,
+					  TEMPI_COL_DATE, date,
+					  -1);
+	g_free(markup);
+
+	if (prepend || last_day == DATE_NONE)
+		last_day = day;
+
+	stats_end(STAT_DATE_HDR, start);
+}
+
+/*
+ * Add a log entry to the history list at position (-1 to append).
+ *
+ * Only whether it has a description is kept, it's fetched from the
+ * database when needed.
+ */
+static void add_tempi_row(struct widgets *w, int position, gint64 id,
+			  const char *date, int day, const char *entity,
+			  const char *project, const char *sub_project,
+			  int secs, bool has_desc)
+{
+	GtkTreeIter iter;
+	char buf[16];
+
+	gtk_list_store_insert_with_values(w->tempi_ls, &iter, position,
+			TEMPI_COL_ID, id,
+			TEMPI_COL_COMPANY, entity,
+			TEMPI_COL_PROJECT, project,
+			TEMPI_COL_SUB_PROJECT, sub_project,
+			TEMPI_COL_DURATION, secs_to_dur(secs, buf, sizeof(buf),
+							NULL),
+			TEMPI_COL_HAS_DESCRIPTION, has_desc,
+			TEMPI_COL_EDITABLE, is_today(day),
+			TEMPI_COL_DATE, date,
+			-1);
+}
+
+static void cb_summaries(GtkWidget *widget __attribute__((unused)),
+			 struct widgets *w)
+{
+	do_summaries(w);
+}
+
+static void cb_sum_export(GtkWidget *widget __attribute__((unused)),
+			  struct widgets *w)
+{
+	summaries_export(w);
+}
+
+void cb_close_sum_win(GtkButton *button __attribute__((unused)),
+		      GtkWidget *sum_win)
+{
+	gtk_widget_hide(sum_win);
+}
+
+static void cb_search(GtkWidget *widget __attribute__((unused)),
+		      struct widgets *w)
+{
+	gtk_widget_show(w->search_win);
+	gtk_window_present(GTK_WINDOW(w->search_win));
+	gtk_widget_grab_focus(w->search_entry);
+}
+
+static void cb_search_changed(GtkWidget *widget __attribute__((unused)),
+			      struct widgets *w)
+{
+	do_search(w);
+}
+
+void cb_close_search_win(GtkButton *button __attribute__((unused)),
+			 GtkWidget *search_win)
+{
+	gtk_widget_hide(search_win);
+}
+
+static void free_named_timer(gpointer data)
+{
+	struct named_timer *t = data;
+
+	stopwatch_stop(&t->stopwatch);
+	g_free(t->entity);
+	g_free(t->project);
+	g_free(t->sub_project);
+	g_slice_free(struct named_timer, t);
+}
+
+static struct named_timer *find_named_timer(guint id)
+{
+	guint i;
+
+	for (i = 0; i < timers->len; i++) {
+		struct named_timer *t = g_ptr_array_index(timers, i);
+
+		if (t->id == id)
+			return t;
+	}
+
+	return NULL;
+}
+
+static bool find_timer_row(struct widgets *w, guint id, GtkTreeIter *iter)
+{
+	GtkTreeModel *model = GTK_TREE_MODEL(w->timers_ls);
+	gboolean valid = gtk_tree_model_get_iter_first(model, iter);
+
+	while (valid) {
+		guint row_id;
+
+		gtk_tree_model_get(model, iter, TIMERS_COL_ID, &row_id, -1);
+		if (row_id == id)
+			return true;
+
+		valid = gtk_tree_model_iter_next(model, iter);
+	}
+
+	return false;
+}
+
+static void update_timer_row(struct widgets *w, const struct named_timer *t,
+			     GtkTreeIter *iter)
+{
+	const char *state = "";
+	char buf[16];
+
+	if (t->saving)
+		state = "Saving";
+	else if (stopwatch_is_running(&t->stopwatch))
+		state = REC_BTN;
+
+	gtk_list_store_set(w->timers_ls, iter,
+			   TIMERS_COL_STATE, state,
+			   TIMERS_COL_ELAPSED,
+			   secs_to_dur(stopwatch_elapsed(&t->stopwatch), buf,
+				       sizeof(buf), NULL),
+			   -1);
 }
 
-static void cb_new(GtkButton *button __attribute__((unused)),
-		   struct widgets *w)
+static void remove_named_timer(struct widgets *w, struct named_timer *t)
 {
-	GtkTextBuffer *desc_buf;
+	GtkTreeIter iter;
 
-	if (!override_unsaved_recording(w))
-		return;
-	else
-		unsaved_recording = false;
+	if (find_timer_row(w, t->id, &iter))
+		gtk_list_store_remove(w->timers_ls, &iter);
+	g_ptr_array_remove(timers, t);
+}
 
-	gtk_widget_set_sensitive(w->save, false);
-	gtk_widget_set_sensitive(w->new, false);
+/* Once saved, a named timer is done with, otherwise it's kept to retry */
+static void named_timer_saved(struct widgets *w, guint id, bool ok)
+{
+	struct named_timer *t = find_named_timer(id);
+	GtkTreeIter iter;
 
-	gtk_entry_set_text(GTK_ENTRY(w->company), "");
-	gtk_entry_set_text(GTK_ENTRY(w->project), "");
-	gtk_entry_set_text(GTK_ENTRY(w->sub_project), "");
-	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->hours), 0.0);
-	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->minutes), 0.0);
-	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->seconds), 0.0);
+	/* Removed while it was being saved */
+	if (!t)
+		return;
 
-	desc_buf = gtk_text_buffer_new(NULL);
-	gtk_text_buffer_set_text(desc_buf, "", -1);
-	gtk_text_view_set_buffer(GTK_TEXT_VIEW(w->description), desc_buf);
+	if (ok) {
+		remove_named_timer(w, t);
+		return;
+	}
 
-	elapsed_seconds = 0;
-	tempus_id = -1;
+	t->saving = false;
+	if (find_timer_row(w, id, &iter))
+		update_timer_row(w, t, &iter);
 }
 
-static void create_date_hdr(struct widgets *w, const char *date, bool reorder)
+/*
+ * The one tick for everything that's running, the entry form's timer &
+ * the named timers. It doesn't run while we're hidden.
+ */
+static void cb_tick(void *data)
 {
-	GtkWidget *sep = gtk_separator_new(GTK_ORIENTATION_HORIZONTAL);
-	GtkWidget *date_hdr = gtk_label_new(date);
-	const char *dow = get_day_of_week_abr(date);
-	char *markup;
+	struct widgets *w = data;
+	GtkTreeModel *model = GTK_TREE_MODEL(w->timers_ls);
+	GtkTreeIter iter;
+	gboolean valid;
 
-	if (is_today(date)) {
-		const char *date_fmt = "<span weight=\"bold\">\%s</span> <span size=\"small\">(\%s)</span>";
+	if (timer_state == TIMER_RUNNING)
+		update_timer_display(w);
 
-		markup = g_markup_printf_escaped(date_fmt, date, dow);
-		gtk_label_set_markup(GTK_LABEL(date_hdr), markup);
+	valid = gtk_tree_model_get_iter_first(model, &iter);
+	while (valid) {
+		const struct named_timer *t;
+		guint id;
 
-		todays_date_hdr_displayed = true;
-	} else {
-		const char *date_fmt = "\%s <span size=\"small\">(\%s)</span>";
+		gtk_tree_model_get(model, &iter, TIMERS_COL_ID, &id, -1);
+		t = find_named_timer(id);
+		if (t && stopwatch_is_running(&t->stopwatch))
+			update_timer_row(w, t, &iter);
 
-		markup = g_markup_printf_escaped(date_fmt, date, dow);
-		gtk_label_set_markup(GTK_LABEL(date_hdr), markup);
+		valid = gtk_tree_model_iter_next(model, &iter);
 	}
-	gtk_widget_set_halign(date_hdr, GTK_ALIGN_START);
-	gtk_widget_set_margin_start(date_hdr, 10);
-	g_free(markup);
+}
+
+/*
+ * Add an entry tempusd has saved (for us or whoever else), from the
+ * fields after OK or EV (see saved_fields() in tempusd.c).
+ *
+ * Returns its id, or -1 if the fields aren't what they should be.
+ */
+static gint64 add_saved_entry(struct widgets *w, char **fields)
+{
+	GtkTreeIter iter;
+	const char *date;
+	gint64 id;
+	int day;
 
-	gtk_box_pack_start(GTK_BOX(w->list_box), sep, false, false, 5);
-	gtk_box_pack_start(GTK_BOX(w->list_box), date_hdr, false, false, 0);
+	if (g_strv_length(fields) < 9)
+		return -1;
 
-	if (reorder) {
-		gtk_box_reorder_child(GTK_BOX(w->list_box), sep, 0);
-		gtk_box_reorder_child(GTK_BOX(w->list_box), date_hdr, 1);
-	}
+	id = g_ascii_strtoll(fields[5], NULL, 10);
+	date = fields[6];
+	day = date_to_day(date);
 
-	gtk_widget_show(sep);
-	gtk_widget_show(date_hdr);
+	if (!todays_date_hdr_displayed || last_day != day)
+		add_date_hdr(w, date, day, true);
 
-	snprintf(last_date, sizeof(last_date), "%s", date);
-}
+	/* Replace any previous version of this entry */
+	if (find_editable_row(w, id, &iter))
+		gtk_list_store_remove(w->tempi_ls, &iter);
 
-static struct list_w *create_list_widget(struct widgets *w, int id)
-{
-	struct list_w *lw = malloc(sizeof(struct list_w));
-	char s_id[22];
+	/* 1 for the position to take into account today's date header */
+	add_tempi_row(w, 1, id, date, day, fields[2], fields[3], fields[4],
+		      atoi(fields[1]), *fields[8]);
+	desc_cache_insert(id, fields[8]);
 
-	lw->hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-	lw->company = gtk_entry_new();
-	lw->project = gtk_entry_new();
-	gtk_entry_set_width_chars(GTK_ENTRY(lw->project), 25);
-	lw->sub_project = gtk_entry_new();
-	gtk_entry_set_width_chars(GTK_ENTRY(lw->sub_project), 25);
-	lw->hours = gtk_entry_new();
-	lw->edit = gtk_button_new_with_label("Edit");
+	/* An edit isn't another use of its names */
+	if (completion && strcmp(fields[7], "1") == 0)
+		completion_add(completion, fields[2], fields[3], fields[4],
+			       day, 1);
 
-	lw->data.description = NULL;
+	return id;
+}
 
-	gtk_editable_set_editable(GTK_EDITABLE(lw->company), false);
-	gtk_editable_set_editable(GTK_EDITABLE(lw->project), false);
-	gtk_editable_set_editable(GTK_EDITABLE(lw->sub_project), false);
-	gtk_editable_set_editable(GTK_EDITABLE(lw->hours), false);
+static void cb_saved(char **fields, void *data)
+{
+	struct save_job *job = data;
+	struct widgets *w = job->w;
+	bool same_form = !job->timer_id && job->form_gen == form_gen;
+	gint64 id = -1;
+
+	if (fields && strcmp(fields[0], "OK") == 0)
+		id = add_saved_entry(w, fields + 1);
+	else if (fields)
+		fprintf(stderr, "tempusd: %s\n",
+			fields[1] ? fields[1] : "Bad reply");
+
+	if (job->timer_id)
+		named_timer_saved(w, job->timer_id, id != -1);
+
+	if (id == -1) {
+		/* tempusd still has it, if it was the recording */
+		if (same_form)
+			unsaved_recording = true;
+		goto out_free;
+	}
+	stats_end(STAT_SAVE, job->start);
 
-	gtk_widget_set_can_focus(lw->company, false);
-	gtk_widget_set_can_focus(lw->project, false);
-	gtk_widget_set_can_focus(lw->sub_project, false);
-	gtk_widget_set_can_focus(lw->hours, false);
+	/* Unless we've since moved on to another entry, keep editing this one */
+	if (same_form)
+		tempus_id = id;
 
-	gtk_entry_set_has_frame(GTK_ENTRY(lw->company), false);
-	gtk_entry_set_has_frame(GTK_ENTRY(lw->project), false);
-	gtk_entry_set_has_frame(GTK_ENTRY(lw->sub_project), false);
-	gtk_entry_set_has_frame(GTK_ENTRY(lw->hours), false);
+out_free:
+	if (same_form && timer_state == TIMER_STOPPED)
+		gtk_widget_set_sensitive(w->save, true);
 
-	gtk_entry_set_width_chars(GTK_ENTRY(lw->hours), 10);
+	g_slice_free(struct save_job, job);
+}
 
-	gtk_widget_set_margin_start(lw->company, 48);
-	gtk_box_pack_start(GTK_BOX(lw->hbox), lw->company, false, false, 0);
-	gtk_box_pack_start(GTK_BOX(lw->hbox), lw->project, false, false, 0);
-	gtk_box_pack_start(GTK_BOX(lw->hbox), lw->sub_project, false, false,
-			0);
-	gtk_box_pack_start(GTK_BOX(lw->hbox), lw->hours, false, false, 0);
-	gtk_box_pack_end(GTK_BOX(lw->hbox), lw->edit, false, false, 5);
+static struct save_job *new_save_job(struct widgets *w, guint timer_id)
+{
+	struct save_job *job = g_slice_new(struct save_job);
 
-	snprintf(s_id, sizeof(s_id), "%d", id);
-	gtk_widget_set_name(lw->edit, s_id);
-	g_signal_connect(G_OBJECT(lw->edit), "clicked", G_CALLBACK(cb_edit),
-			w);
+	job->w = w;
+	job->form_gen = form_gen;
+	job->timer_id = timer_id;
+	job->start = stats_begin();
 
-	return lw;
+	return job;
 }
 
-static void cb_summaries(GtkButton *button __attribute__((unused)),
-			 struct widgets *w)
+static void cb_sum_win_hide(GtkWidget *sum_win __attribute__((unused)),
+			    gpointer data __attribute__((unused)))
 {
-	do_summaries(w, tempi_store);
+	summaries_cancel();
 }
 
-void cb_close_sum_win(GtkButton *button __attribute__((unused)),
-		      GtkWidget *sum_win)
+static void cb_search_win_hide(GtkWidget *search_win __attribute__((unused)),
+			       gpointer data __attribute__((unused)))
 {
-	gtk_widget_hide(sum_win);
+	search_cancel();
 }
 
 static void cb_save(GtkButton *button __attribute__((unused)),
 		    struct widgets *w)
 {
-	sqlite3_stmt *stmt;
-	sqlite3 *db;
-	time_t now = time(NULL) - new_day_offset;
-	struct tm *tm = localtime(&now);
-	struct list_w *lw;
-	GtkTextBuffer *desc_buf;
-	GtkTextIter start;
-	GtkTextIter end;
-	int rc;
-	char hours[14];
-	char date[11];
-	const char *desc;
-	const char *sql = tempus_id == -1 ? SQL_INSERT : SQL_UPDATE;
-
-	sqlite3_open(tempi_store, &db);
-	rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-	if (rc != SQLITE_OK)
-		fprintf(stderr, "sqlite prepare failed: %s\n",
-			sqlite3_errmsg(db));
-
-	strftime(date, sizeof(date), "%F", tm);	/* YYYY-MM-DD */
-	if (!todays_date_hdr_displayed || strcmp(last_date, date) != 0)
-		create_date_hdr(w, date, true);
-
-	sqlite3_bind_text(stmt, 1, date, -1, NULL);
-	sqlite3_bind_text(stmt, 2, gtk_entry_get_text(GTK_ENTRY(w->company)),
-			  -1, NULL);
-	sqlite3_bind_text(stmt, 3, gtk_entry_get_text(GTK_ENTRY(w->project)),
-			  -1, NULL);
-	sqlite3_bind_text(stmt, 4,
-			  gtk_entry_get_text(GTK_ENTRY(w->sub_project)), -1,
-			  NULL);
-	sqlite3_bind_int(stmt, 5, elapsed_seconds);
+	const char *args[7];
+	char id[24];
+	char secs[16];
+	char *desc;
 
-	desc_buf = gtk_text_view_get_buffer(GTK_TEXT_VIEW(w->description));
-	gtk_text_buffer_get_start_iter(desc_buf, &start);
-	gtk_text_buffer_get_end_iter(desc_buf, &end);
-	desc = gtk_text_buffer_get_text(desc_buf, &start, &end, true);
-	sqlite3_bind_text(stmt, 6, desc, -1, NULL);
-
-	if (tempus_id > -1)
-		sqlite3_bind_int(stmt, 7, tempus_id);
-
-	rc = sqlite3_step(stmt);
-	if (rc != SQLITE_DONE)
-		fprintf(stderr, "sqlite execution failed: %s\n",
-			sqlite3_errmsg(db));
-	sqlite3_finalize(stmt);
-	if (tempus_id == -1)
-		tempus_id = sqlite3_last_insert_rowid(db);
-	sqlite3_close(db);
-
-	lw = create_list_widget(w, tempus_id);
-	gtk_entry_set_text(GTK_ENTRY(lw->company), gtk_entry_get_text(
-				GTK_ENTRY(w->company)));
-	gtk_entry_set_text(GTK_ENTRY(lw->project), gtk_entry_get_text(
-				GTK_ENTRY(w->project)));
-	gtk_entry_set_text(GTK_ENTRY(lw->sub_project), gtk_entry_get_text(
-				GTK_ENTRY(w->sub_project)));
+	/* Take into account a possibly adjusted value */
+	update_elapased_seconds(w);
 
-	if (desc && strlen(desc) > 0)
-		lw->data.description = strdup(desc);
-	gtk_widget_set_tooltip_text(lw->hbox, desc);
+	/* It goes with what's in the form now */
+	if (edit_timeout_id)
+		g_source_remove(edit_timeout_id);
+	edit_timeout_id = 0;
 
-	update_elapased_seconds(w);
-	secs_to_dur(elapsed_seconds, hours, sizeof(hours), NULL);
-	gtk_entry_set_text(GTK_ENTRY(lw->hours), hours);
+	snprintf(id, sizeof(id), "%lld", tempus_id);
+	snprintf(secs, sizeof(secs), "%u", stopwatch_elapsed(&stopwatch));
+	desc = get_description(w);
 
-	g_tree_replace(tempi, GINT_TO_POINTER(tempus_id), lw);
+	args[0] = id;
+	args[1] = secs;
+	args[2] = gtk_entry_get_text(GTK_ENTRY(w->company));
+	args[3] = gtk_entry_get_text(GTK_ENTRY(w->project));
+	args[4] = gtk_entry_get_text(GTK_ENTRY(w->sub_project));
+	args[5] = desc;
+	args[6] = NULL;
 
-	gtk_container_add(GTK_CONTAINER(w->list_box), lw->hbox);
 	/*
-	 * 2 for the position to take into account the GtkSeparator
-	 * and GtkLabel
+	 * Don't allow this entry to be saved again until we know its id,
+	 * otherwise we could end up inserting it twice.
 	 */
-	gtk_box_reorder_child(GTK_BOX(w->list_box), lw->hbox, 2);
-	gtk_widget_show_all(lw->hbox);
+	gtk_widget_set_sensitive(w->save, false);
+
+	ctl_send("commit", args, cb_saved, new_save_job(w, 0));
+	g_free(desc);
 
 	update_window_title(w);
 	unsaved_recording = false;
 }
 
-static int store_sub_project_name(gpointer key,
-				  gpointer value __attribute__((unused)),
-				  gpointer data)
+static void cb_add_timer(GtkButton *button __attribute__((unused)),
+			 struct widgets *w)
 {
-	struct widgets *w = (struct widgets *)data;
+	struct named_timer *t = g_slice_new0(struct named_timer);
 	GtkTreeIter iter;
+	char *name;
+
+	t->id = ++last_timer_id;
+	t->entity = g_strdup(gtk_entry_get_text(GTK_ENTRY(w->company)));
+	t->project = g_strdup(gtk_entry_get_text(GTK_ENTRY(w->project)));
+	t->sub_project = g_strdup(gtk_entry_get_text(
+				GTK_ENTRY(w->sub_project)));
+	g_ptr_array_add(timers, t);
 
-	gtk_list_store_append(w->sub_projects, &iter);
-	gtk_list_store_set(w->sub_projects, &iter, 0, (char *)key, -1);
+	stopwatch_start(&t->stopwatch);
 
-	return 0;
+	name = g_strdup_printf("%s / %s / %s", t->entity, t->project,
+			       t->sub_project);
+	gtk_list_store_insert_with_values(w->timers_ls, &iter, -1,
+					  TIMERS_COL_ID, t->id,
+					  TIMERS_COL_NAME, name,
+					  -1);
+	g_free(name);
+	update_timer_row(w, t, &iter);
+
+	gtk_tree_selection_select_iter(gtk_tree_view_get_selection(
+				GTK_TREE_VIEW(w->timers_view)), &iter);
+}
+
+/* The selected named timer, if there is one that isn't being saved */
+static struct named_timer *get_selected_timer(struct widgets *w,
+					      GtkTreeIter *iter)
+{
+	GtkTreeSelection *sel = gtk_tree_view_get_selection(
+			GTK_TREE_VIEW(w->timers_view));
+	struct named_timer *t;
+	guint id;
+
+	if (!gtk_tree_selection_get_selected(sel, NULL, iter))
+		return NULL;
+
+	gtk_tree_model_get(GTK_TREE_MODEL(w->timers_ls), iter,
+			   TIMERS_COL_ID, &id, -1);
+	t = find_named_timer(id);
+	if (!t || t->saving)
+		return NULL;
+
+	return t;
+}
+
+static void cb_timer_toggle(GtkButton *button __attribute__((unused)),
+			    struct widgets *w)
+{
+	GtkTreeIter iter;
+	struct named_timer *t = get_selected_timer(w, &iter);
+
+	if (!t)
+		return;
+
+	if (stopwatch_is_running(&t->stopwatch))
+		stopwatch_stop(&t->stopwatch);
+	else
+		stopwatch_start(&t->stopwatch);
+	update_timer_row(w, t, &iter);
 }
 
-static int store_project_name(gpointer key,
-			      gpointer value __attribute__((unused)),
-			      gpointer data)
+/* Saved as a new entry for today, like the entry form's are */
+static void cb_timer_save(GtkButton *button __attribute__((unused)),
+			  struct widgets *w)
 {
-	struct widgets *w = (struct widgets *)data;
 	GtkTreeIter iter;
+	struct named_timer *t = get_selected_timer(w, &iter);
+	const char *args[5];
+	char secs[16];
 
-	gtk_list_store_append(w->projects, &iter);
-	gtk_list_store_set(w->projects, &iter, 0, (char *)key, -1);
+	if (!t)
+		return;
 
-	return 0;
+	stopwatch_stop(&t->stopwatch);
+	t->saving = true;
+	update_timer_row(w, t, &iter);
+
+	snprintf(secs, sizeof(secs), "%u", stopwatch_elapsed(&t->stopwatch));
+	args[0] = secs;
+	args[1] = t->entity;
+	args[2] = t->project;
+	args[3] = t->sub_project;
+	args[4] = NULL;
+
+	ctl_send("save", args, cb_saved, new_save_job(w, t->id));
 }
 
-static int store_company_name(gpointer key,
-			      gpointer value __attribute__((unused)),
-			      gpointer data)
+static void cb_timer_remove(GtkButton *button __attribute__((unused)),
+			    struct widgets *w)
 {
-	struct widgets *w = (struct widgets *)data;
 	GtkTreeIter iter;
+	struct named_timer *t = get_selected_timer(w, &iter);
+	int response;
 
-	gtk_list_store_append(w->companies, &iter);
-	gtk_list_store_set(w->companies, &iter, 0, (char *)key, -1);
+	if (!t)
+		return;
 
-	return 0;
+	if (stopwatch_elapsed(&t->stopwatch) > 0) {
+		response = gtk_dialog_run(GTK_DIALOG(w->dialog));
+		gtk_widget_hide(w->dialog);
+		if (response == GTK_RESPONSE_CANCEL)
+			return;
+	}
+
+	remove_named_timer(w, t);
 }
 
 static int set_tempi_store(void)
@@ -606,8 +1396,7 @@ static int set_tempi_store(void)
 	struct stat sb;
 	int err;
 
-	snprintf(tempi_dir, sizeof(tempi_dir), "%s/.local/share/tempus",
-		 getenv("HOME"));
+	snprintf(tempi_dir, sizeof(tempi_dir), TEMPI_DIR, getenv("HOME"));
 	g_mkdir_with_parents(tempi_dir, 0777);
 
 	/* Check if we need to do the tokyocabinet -> sqlite conversion */
@@ -615,7 +1404,7 @@ static int set_tempi_store(void)
 		 tempi_dir);
 	err = stat(tempi_store, &sb);
 	if (!err)
-		return  0;
+		return 0;
 
 	/* Convert the db from tokyocabinet to sqlite */
 	snprintf(tempi_store, sizeof(tempi_store), "%s/tempus.tdb", tempi_dir);
@@ -630,106 +1419,532 @@ static int set_tempi_store(void)
 	return 0;
 }
 
+/* Whatever is left of the history after today's entries */
+static void load_history_page(struct widgets *w, int before_day,
+			      gint64 before_id);
+
+static struct tempi_row *read_tempi_row(sqlite3_stmt *stmt)
+{
+	struct tempi_row *row = g_slice_new(struct tempi_row);
+
+	row->id = sqlite3_column_int64(stmt, SQL_COL_ID);
+	row->day = sqlite3_column_int(stmt, SQL_COL_DAY);
+	row->date = g_strdup((char *)sqlite3_column_text(stmt, SQL_COL_DATE));
+	row->entity = g_strdup((char *)sqlite3_column_text(stmt,
+							   SQL_COL_ENTITY));
+	row->project = g_strdup((char *)sqlite3_column_text(stmt,
+							    SQL_COL_PROJECT));
+	row->sub_project = g_strdup((char *)sqlite3_column_text(stmt,
+							SQL_COL_SUB_PROJECT));
+	row->duration = sqlite3_column_int(stmt, SQL_COL_DURATION);
+	row->description = NULL;
+	row->has_description =
+		sqlite3_column_bytes(stmt, SQL_COL_DESCRIPTION) > 0;
+
+	return row;
+}
+
+static void load_tempi_work(void *data)
+{
+	struct load_job *job = data;
+	sqlite3_stmt *stmt = db_stmt(DB_STMT_HISTORY);
+	u64 start = stats_begin();
+
+	sqlite3_bind_int(stmt, 1, job->from);
+	sqlite3_bind_int(stmt, 2, job->before_day);
+	sqlite3_bind_int64(stmt, 3, job->before_id);
+	sqlite3_bind_int(stmt, 4, job->limit);
+
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+		g_ptr_array_add(job->rows, read_tempi_row(stmt));
+	sqlite3_reset(stmt);
+
+	stats_count(STAT_HISTORY_ROWS, job->rows->len);
+	stats_end(STAT_HISTORY_QUERY, start);
+}
+
+/*
+ * Append as much of a page of the history as fits in the time budget,
+ * carrying on from the next idle. Once it's all in, the next page is
+ * fetched, if there is one.
+ */
+static gboolean fill_history(gpointer data)
+{
+	struct load_job *job = data;
+	struct widgets *w = job->w;
+	gint64 budget_end = g_get_monotonic_time() + HISTORY_FILL_BUDGET_US;
+	struct tempi_row *row;
+	u64 start = stats_begin();
+
+	while (job->next < job->rows->len) {
+		row = g_ptr_array_index(job->rows, job->next++);
+
+		if (row->day != history_day)
+			add_date_hdr(w, row->date, row->day, false);
+		history_day = row->day;
+
+		add_tempi_row(w, -1, row->id, row->date, row->day,
+			      row->entity, row->project, row->sub_project,
+			      row->duration, row->has_description);
+
+		if (g_get_monotonic_time() >= budget_end)
+			break;
+	}
+
+	stats_end(STAT_HISTORY_FILL, start);
+
+	if (job->next < job->rows->len)
+		return G_SOURCE_CONTINUE;
+
+	if (job->limit == -1) {
+		/* Today's entries are in */
+		stats_end(STAT_STARTUP, startup_start);
+		startup_start = 0;
+	}
+
+	/* A page of today's entries is followed by the rest regardless */
+	if (!job->last &&
+	    (job->limit == -1 || (int)job->rows->len == job->limit)) {
+		if (job->rows->len > 0) {
+			row = g_ptr_array_index(job->rows,
+						job->rows->len - 1);
+			load_history_page(w, row->day, row->id);
+		} else {
+			load_history_page(w, job->before_day,
+					  job->before_id);
+		}
+	}
+
+	g_ptr_array_free(job->rows, true);
+	g_slice_free(struct load_job, job);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean load_tempi_done(gpointer data)
+{
+	/* Below redrawing, so a frame can be drawn between each slice */
+	g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, fill_history, data, NULL);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void submit_history_load(struct widgets *w, int from, int before_day,
+				gint64 before_id, int limit)
+{
+	struct load_job *job = g_slice_new(struct load_job);
+
+	job->w = w;
+	job->rows = g_ptr_array_new_with_free_func(free_tempi_row);
+	job->next = 0;
+	job->from = from;
+	job->before_day = before_day;
+	job->before_id = before_id;
+	job->limit = limit;
+	job->last = false;
+
+	db_submit(load_tempi_work, load_tempi_done, job);
+}
+
+static void load_history_page(struct widgets *w, int before_day,
+			      gint64 before_id)
+{
+	submit_history_load(w, from_day, before_day, before_id,
+			    HISTORY_PAGE_ROWS);
+}
+
+static void load_completions_work(void *data)
+{
+	struct completion *comp = data;
+	sqlite3_stmt *stmt = db_stmt(DB_STMT_COMPLETIONS);
+
+	/* Completions are offered from all names, not just the history's */
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+		completion_add(comp,
+			       (char *)sqlite3_column_text(stmt, 0),
+			       (char *)sqlite3_column_text(stmt, 1),
+			       (char *)sqlite3_column_text(stmt, 2),
+			       date_to_day((char *)sqlite3_column_text(stmt,
+								       3)),
+			       sqlite3_column_int(stmt, 4));
+	sqlite3_reset(stmt);
+}
+
+static gboolean load_completions_done(gpointer data)
+{
+	completion = data;
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * The history is read on the database thread a page at a time, newest
+ * first, and added to the list from the main loop in slices of at most
+ * HISTORY_FILL_BUDGET_US, so the window is usable straight away no
+ * matter how much history there is.
+ *
+ * All of today's entries make up the first page, as they're the ones
+ * that can be edited. Pages are then keyed on the (day, id) of the last
+ * row of the previous one.
+ */
+static void load_tempi_db(struct widgets *w)
+{
+	int today = date_today();
+
+	submit_history_load(w, from_day > today ? from_day : today, to_day,
+			    G_MAXINT64, -1);
+	db_submit(load_completions_work, load_completions_done,
+		  completion_new());
+}
+
+/*
+ * The snapshot is good if no entries have been changed or removed since
+ * it was taken, in which case only the entries added since are read.
+ */
+static void snapshot_check_work(void *data)
+{
+	struct snapshot_job *job = data;
+	const struct snapshot_key *key = &job->snap->key;
+	sqlite3_stmt *stmt;
+	u64 start = stats_begin();
+
+	/* So nothing can come in between the check & reading what's new */
+	sqlite3_exec(db_get(), "BEGIN", NULL, NULL, NULL);
+
+	stmt = db_stmt(DB_STMT_SNAPSHOT_KEY);
+	sqlite3_bind_int64(stmt, 1, key->max_id);
+	job->valid = sqlite3_step(stmt) == SQLITE_ROW &&
+		     sqlite3_column_int64(stmt, 0) == key->changes &&
+		     sqlite3_column_int64(stmt, 1) == key->max_id &&
+		     sqlite3_column_int64(stmt, 2) == key->nr_entries;
+	sqlite3_reset(stmt);
+	if (!job->valid)
+		goto out_commit;
+
+	stmt = db_stmt(DB_STMT_HISTORY_SINCE);
+	sqlite3_bind_int64(stmt, 1, key->max_id);
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+		g_ptr_array_add(job->added, read_tempi_row(stmt));
+	sqlite3_reset(stmt);
+
+	stats_count(STAT_HISTORY_ROWS, job->added->len);
+
+out_commit:
+	sqlite3_exec(db_get(), "COMMIT", NULL, NULL, NULL);
+	stats_end(STAT_SNAPSHOT_LOAD, start);
+}
+
+static struct tempi_row *snapshot_tempi_row(const struct snapshot_row *sr)
+{
+	struct tempi_row *row = g_slice_new(struct tempi_row);
+
+	row->id = sr->id;
+	row->day = sr->day;
+	row->date = g_strdup(sr->date);
+	row->entity = g_strdup(sr->entity);
+	row->project = g_strdup(sr->project);
+	row->sub_project = g_strdup(sr->sub_project);
+	row->duration = sr->duration;
+	row->description = NULL;
+	row->has_description = sr->has_description;
+
+	return row;
+}
+
+/*
+ * Fill the history from the snapshot with the entries added since
+ * merged in, or if it's out of date, straight from the database.
+ */
+static gboolean snapshot_check_done(gpointer data)
+{
+	struct snapshot_job *job = data;
+	struct snapshot *snap = job->snap;
+	GPtrArray *added = job->added;
+	struct load_job *load;
+	struct completion *comp;
+	guint i = 0;
+	guint j = 0;
+
+	if (!job->valid) {
+		load_tempi_db(job->w);
+		goto out_free;
+	}
+
+	comp = completion_new();
+	for (i = 0; i < snap->completions->len; i++) {
+		const struct snapshot_completion *sc = &g_array_index(
+				snap->completions, struct snapshot_completion,
+				i);
+
+		completion_add(comp, sc->entity, sc->project, sc->sub_project,
+			       sc->day, sc->count);
+	}
+	for (j = 0; j < added->len; j++) {
+		const struct tempi_row *row = g_ptr_array_index(added, j);
+
+		completion_add(comp, row->entity, row->project,
+			       row->sub_project, row->day, 1);
+	}
+	completion = comp;
+
+	load = g_slice_new0(struct load_job);
+	load->w = job->w;
+	load->rows = g_ptr_array_new_with_free_func(free_tempi_row);
+	load->limit = -1;
+	load->last = true;
+
+	/* Both are newest first, the added rows are handed on as they are */
+	g_ptr_array_set_free_func(added, NULL);
+	i = j = 0;
+	while (i < snap->rows->len || j < added->len) {
+		const struct snapshot_row *sr = NULL;
+		struct tempi_row *row = NULL;
+
+		if (i < snap->rows->len)
+			sr = &g_array_index(snap->rows, struct snapshot_row,
+					    i);
+		if (j < added->len)
+			row = g_ptr_array_index(added, j);
+
+		if (row && (!sr || row->day > sr->day ||
+			    (row->day == sr->day && row->id > sr->id))) {
+			j++;
+		} else {
+			row = snapshot_tempi_row(sr);
+			i++;
+		}
+
+		/* The window may have moved on since the snapshot */
+		if (row->day < from_day)
+			free_tempi_row(row);
+		else
+			g_ptr_array_add(load->rows, row);
+	}
+
+	snapshot_key = snap->key;
+	snapshot_loaded = true;
+
+	g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, fill_history, load, NULL);
+
+out_free:
+	snapshot_free(snap);
+	g_ptr_array_free(added, true);
+	g_slice_free(struct snapshot_job, job);
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * The default history window is snapshot on the way out, so the next
+ * start up only has to check it's still good & read what's been added
+ * since.
+ */
 static void load_tempi(struct widgets *w)
 {
+	struct snapshot_job *job;
+	struct snapshot *snap = NULL;
+
+	if (default_window)
+		snap = snapshot_open(snapshot_file);
+	if (!snap || snap->key.from_day > from_day) {
+		snapshot_free(snap);
+		load_tempi_db(w);
+		return;
+	}
+
+	job = g_slice_new(struct snapshot_job);
+	job->w = w;
+	job->snap = snap;
+	job->valid = false;
+	job->added = g_ptr_array_new_with_free_func(free_tempi_row);
+
+	db_submit(snapshot_check_work, snapshot_check_done, job);
+}
+
+/*
+ * Write the snapshot of the history window & completions, unless the
+ * one the history was loaded from is still good.
+ */
+static void save_snapshot_work(void *data __attribute__((unused)))
+{
+	struct snapshot_writer *sw;
+	struct snapshot_key key;
 	sqlite3_stmt *stmt;
-	sqlite3 *db;
-	char prev_date[11] = "\0";
-	GTree *companies;
-	GTree *projects;
-	GTree *sub_projects;
+	u64 start = stats_begin();
 
-	/*
-	 * Get the list of company, project & sub project names to store
-	 * for the accompanying entry auto completions. These will be
-	 * automatically de-duplicated and sorted.
-	 */
-	companies = g_tree_new_full((GCompareDataFunc)
-				    (void (*)(void))g_ascii_strcasecmp, NULL,
-				    free, NULL);
-	projects = g_tree_new_full((GCompareDataFunc)
-				   (void (*)(void))g_ascii_strcasecmp, NULL,
-				   free, NULL);
-	sub_projects = g_tree_new_full((GCompareDataFunc)
-				       (void (*)(void))g_ascii_strcasecmp,
-				       NULL, free, NULL);
-
-	sqlite3_open(tempi_store, &db);
-	sqlite3_prepare_v2(db, "SELECT * FROM tempus ORDER by date DESC",
-			   -1, &stmt, NULL);
+	sqlite3_exec(db_get(), "BEGIN", NULL, NULL, NULL);
+
+	stmt = db_stmt(DB_STMT_SNAPSHOT_KEY);
+	sqlite3_bind_int64(stmt, 1, G_MAXINT64);
+	if (sqlite3_step(stmt) != SQLITE_ROW) {
+		sqlite3_reset(stmt);
+		sqlite3_exec(db_get(), "COMMIT", NULL, NULL, NULL);
+		return;
+	}
+	key.changes = sqlite3_column_int64(stmt, 0);
+	key.max_id = sqlite3_column_int64(stmt, 1);
+	key.nr_entries = sqlite3_column_int64(stmt, 2);
+	key.from_day = from_day;
+	sqlite3_reset(stmt);
+
+	if (snapshot_loaded && key.changes == snapshot_key.changes &&
+	    key.max_id == snapshot_key.max_id &&
+	    key.nr_entries == snapshot_key.nr_entries &&
+	    key.from_day == snapshot_key.from_day) {
+		sqlite3_exec(db_get(), "COMMIT", NULL, NULL, NULL);
+		return;
+	}
 
+	sw = snapshot_writer_new();
+
+	stmt = db_stmt(DB_STMT_HISTORY);
+	sqlite3_bind_int(stmt, 1, from_day);
+	sqlite3_bind_int(stmt, 2, DATE_MAX);
+	sqlite3_bind_int64(stmt, 3, G_MAXINT64);
+	sqlite3_bind_int(stmt, 4, -1);
 	while (sqlite3_step(stmt) == SQLITE_ROW) {
-		struct list_w *lw;
-		const char *date;
-		const char *desc;
-		const char *entity;
-		const char *proj;
-		const char *sub_proj;
-		char buf[16];
-		int secs;
-		int id;
-
-		date = (char *)sqlite3_column_text(stmt, 1);
-		if (!show_all && !entry_show(date))
-			break;
+		struct snapshot_row row;
+
+		row.id = sqlite3_column_int64(stmt, SQL_COL_ID);
+		row.day = sqlite3_column_int(stmt, SQL_COL_DAY);
+		row.duration = sqlite3_column_int(stmt, SQL_COL_DURATION);
+		row.has_description =
+			sqlite3_column_bytes(stmt, SQL_COL_DESCRIPTION) > 0;
+		row.date = (char *)sqlite3_column_text(stmt, SQL_COL_DATE);
+		row.entity = (char *)sqlite3_column_text(stmt,
+							 SQL_COL_ENTITY);
+		row.project = (char *)sqlite3_column_text(stmt,
+							  SQL_COL_PROJECT);
+		row.sub_project = (char *)sqlite3_column_text(stmt,
+							SQL_COL_SUB_PROJECT);
+		snapshot_add_row(sw, &row);
+	}
+	sqlite3_reset(stmt);
 
-		if (strcmp(prev_date, date) != 0)
-			create_date_hdr(w, date, false);
-		snprintf(prev_date, sizeof(prev_date), "%s", date);
-
-		id = sqlite3_column_int(stmt, 0);
-		lw = create_list_widget(w, id);
-		entity = (char *)sqlite3_column_text(stmt, 2);
-		gtk_entry_set_text(GTK_ENTRY(lw->company), entity);
-		proj = (char *)sqlite3_column_text(stmt, 3);
-		gtk_entry_set_text(GTK_ENTRY(lw->project), proj);
-		sub_proj = (char *)sqlite3_column_text(stmt, 4);
-		gtk_entry_set_text(GTK_ENTRY(lw->sub_project), sub_proj);
-		secs = sqlite3_column_int(stmt, 5);
-		gtk_entry_set_text(GTK_ENTRY(lw->hours),
-				   secs_to_dur(secs, buf, sizeof(buf), NULL));
-
-		desc = (char *)sqlite3_column_text(stmt, 6);
-		if (desc && strlen(desc) > 0) {
-			gtk_widget_set_tooltip_text(lw->hbox, desc);
-			lw->data.description = strdup(desc);
-		}
+	stmt = db_stmt(DB_STMT_COMPLETIONS);
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		struct snapshot_completion comp;
+
+		comp.entity = (char *)sqlite3_column_text(stmt, 0);
+		comp.project = (char *)sqlite3_column_text(stmt, 1);
+		comp.sub_project = (char *)sqlite3_column_text(stmt, 2);
+		comp.day = date_to_day((char *)sqlite3_column_text(stmt, 3));
+		comp.count = sqlite3_column_int(stmt, 4);
+		snapshot_add_completion(sw, &comp);
+	}
+	sqlite3_reset(stmt);
+
+	sqlite3_exec(db_get(), "COMMIT", NULL, NULL, NULL);
+
+	snapshot_write(sw, &key, snapshot_file);
+	snapshot_writer_free(sw);
+
+	stats_end(STAT_SNAPSHOT_SAVE, start);
+}
 
-		if (strlen(entity) > 0)
-			g_tree_replace(companies, strdup(entity), NULL);
-		if (strlen(proj) > 0)
-			g_tree_replace(projects, strdup(proj), NULL);
-		if (strlen(sub_proj) > 0)
-			g_tree_replace(sub_projects, strdup(sub_proj), NULL);
+/*
+ * The completions' list stores only hold the best few matches for what
+ * has been typed so far, which are looked up in the completion index as
+ * the text changes.
+ */
+static void cb_completion_changed(GtkEditable *editable, struct widgets *w)
+{
+	GtkWidget *entry = GTK_WIDGET(editable);
+	const char *matches[COMPLETION_MAX];
+	const char *prefix;
+	enum completion_field field;
+	GtkListStore *ls;
+	guint nr = 0;
+	guint i;
+
+	if (entry == w->company) {
+		field = COMPLETION_ENTITY;
+		ls = w->companies;
+	} else if (entry == w->project) {
+		field = COMPLETION_PROJECT;
+		ls = w->projects;
+	} else {
+		field = COMPLETION_SUB_PROJECT;
+		ls = w->sub_projects;
+	}
+
+	prefix = gtk_entry_get_text(GTK_ENTRY(entry));
+	if (completion && *prefix)
+		nr = completion_lookup(completion, field,
+				gtk_entry_get_text(GTK_ENTRY(w->company)),
+				gtk_entry_get_text(GTK_ENTRY(w->project)),
+				prefix, matches, COMPLETION_MAX);
+
+	gtk_list_store_clear(ls);
+	for (i = 0; i < nr; i++)
+		gtk_list_store_insert_with_values(ls, NULL, -1, 0, matches[i],
+						  -1);
+}
+
+static void cb_watching(char **fields, void *data)
+{
+	struct widgets *w = data;
 
-		g_tree_replace(tempi, GINT_TO_POINTER(id), lw);
+	if (fields && strcmp(fields[0], "OK") == 0)
+		apply_status(w, fields + 1, true);
+}
 
-		if (!is_today(date))
-			gtk_widget_set_no_show_all(lw->edit, true);
+static gboolean cb_reconnect(gpointer data);
 
-		gtk_box_pack_start(GTK_BOX(w->list_box), lw->hbox, false,
-				false, 0);
-		gtk_widget_show_all(lw->hbox);
+/* What tempusd has to say, that isn't a reply to us */
+static void cb_ctl_event(char **fields, void *data)
+{
+	struct widgets *w = data;
+
+	if (!fields) {
+		if (reconnect_id)
+			return;
+		/* What it had is journaled, it's picked up from there */
+		fprintf(stderr, "Lost tempusd, reconnecting\n");
+		reconnect_id = g_timeout_add_seconds(1, cb_reconnect, w);
+		return;
 	}
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
 
-	g_tree_foreach(companies, store_company_name, w);
-	g_tree_foreach(projects, store_project_name, w);
-	g_tree_foreach(sub_projects, store_sub_project_name, w);
-	g_tree_destroy(companies);
-	g_tree_destroy(projects);
-	g_tree_destroy(sub_projects);
+	if (!fields[1])
+		return;
+	if (strcmp(fields[1], "saved") == 0)
+		add_saved_entry(w, fields + 1);
+	else
+		apply_status(w, fields + 1, true);
+}
+
+static gboolean cb_reconnect(gpointer data)
+{
+	int fd = ctl_connect_start();
+
+	if (fd == -1)
+		return G_SOURCE_CONTINUE;
+
+	reconnect_id = 0;
+	ctl_conn_free(ctl);
+	ctl = ctl_conn_new(fd, cb_ctl_event, data);
+	ctl_send("watch", NULL, cb_watching, data);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean cb_stats_report(gpointer data __attribute__((unused)))
+{
+	stats_report(stderr);
+
+	return G_SOURCE_CONTINUE;
 }
 
 static void get_widgets(struct widgets *w, GtkBuilder *builder)
 {
 	w->window = GTK_WIDGET(gtk_builder_get_object(builder, "window"));
-	w->list_box = GTK_WIDGET(gtk_builder_get_object(builder, "list_box"));
+	w->list_view = GTK_WIDGET(gtk_builder_get_object(builder,
+							 "list_view"));
 	w->save = GTK_WIDGET(gtk_builder_get_object(builder, "save"));
 	w->new = GTK_WIDGET(gtk_builder_get_object(builder, "new"));
 	w->summaries = GTK_WIDGET(gtk_builder_get_object(builder,
 							 "summaries"));
+	w->search = GTK_WIDGET(gtk_builder_get_object(builder, "search"));
 	w->hours = GTK_WIDGET(gtk_builder_get_object(builder, "hours"));
 	w->minutes = GTK_WIDGET(gtk_builder_get_object(builder, "minutes"));
 	w->seconds = GTK_WIDGET(gtk_builder_get_object(builder, "seconds"));
@@ -742,31 +1957,115 @@ static void get_widgets(struct widgets *w, GtkBuilder *builder)
 	w->description = GTK_WIDGET(gtk_builder_get_object(builder,
 				"description"));
 	w->dialog = GTK_WIDGET(gtk_builder_get_object(builder, "dialog"));
+	w->timers_view = GTK_WIDGET(gtk_builder_get_object(builder,
+							   "timers_view"));
+	w->add_timer = GTK_WIDGET(gtk_builder_get_object(builder,
+							 "add_timer"));
+	w->timer_toggle = GTK_WIDGET(gtk_builder_get_object(builder,
+							    "timer_toggle"));
+	w->timer_save = GTK_WIDGET(gtk_builder_get_object(builder,
+							  "timer_save"));
+	w->timer_remove = GTK_WIDGET(gtk_builder_get_object(builder,
+							    "timer_remove"));
+	w->timers_ls = GTK_LIST_STORE(gtk_builder_get_object(builder,
+							     "timers_ls"));
 	w->companies = GTK_LIST_STORE(gtk_builder_get_object(builder,
 				"companies"));
 	w->projects = GTK_LIST_STORE(gtk_builder_get_object(builder,
 				"projects"));
 	w->sub_projects = GTK_LIST_STORE(gtk_builder_get_object(builder,
 				"sub_projects"));
+	w->tempi_ls = GTK_LIST_STORE(gtk_builder_get_object(builder,
+							    "tempi_ls"));
 
 	w->sum_win = GTK_WIDGET(gtk_builder_get_object(builder, "sum_win"));
+	w->sum_progress = GTK_WIDGET(gtk_builder_get_object(builder,
+							    "sum_progress"));
+	w->sum_period = GTK_WIDGET(gtk_builder_get_object(builder,
+							  "sum_period"));
+	w->sum_from = GTK_WIDGET(gtk_builder_get_object(builder, "sum_from"));
+	w->sum_to = GTK_WIDGET(gtk_builder_get_object(builder, "sum_to"));
+	w->sum_export = GTK_WIDGET(gtk_builder_get_object(builder,
+							  "sum_export"));
 
 	w->summaries_ls = GTK_LIST_STORE(gtk_builder_get_object(builder,
 								"summaries_ls"));
 	w->summaries_tms = GTK_TREE_MODEL_SORT(gtk_builder_get_object(builder,
 								      "summaries_tms"));
 
+	w->search_win = GTK_WIDGET(gtk_builder_get_object(builder,
+							  "search_win"));
+	w->search_entry = GTK_WIDGET(gtk_builder_get_object(builder,
+							    "search_entry"));
+	w->search_from = GTK_WIDGET(gtk_builder_get_object(builder,
+							   "search_from"));
+	w->search_to = GTK_WIDGET(gtk_builder_get_object(builder,
+							 "search_to"));
+	w->search_status = GTK_WIDGET(gtk_builder_get_object(builder,
+				"search_status"));
+	w->search_ls = GTK_LIST_STORE(gtk_builder_get_object(builder,
+							     "search_ls"));
+
 	gtk_widget_set_sensitive(w->save, false);
 	gtk_widget_set_sensitive(w->new, false);
 
+	g_signal_connect(G_OBJECT(w->window), "window-state-event",
+			 G_CALLBACK(cb_window_state), NULL);
 	g_signal_connect(G_OBJECT(w->start), "clicked", G_CALLBACK(
 				cb_start_timer), w);
 	g_signal_connect(G_OBJECT(w->stop), "clicked", G_CALLBACK(
 				cb_stop_timer), w);
 	g_signal_connect(G_OBJECT(w->save), "clicked", G_CALLBACK(cb_save), w);
+	g_signal_connect(G_OBJECT(w->add_timer), "clicked",
+			 G_CALLBACK(cb_add_timer), w);
+	g_signal_connect(G_OBJECT(w->timer_toggle), "clicked",
+			 G_CALLBACK(cb_timer_toggle), w);
+	g_signal_connect(G_OBJECT(w->timer_save), "clicked",
+			 G_CALLBACK(cb_timer_save), w);
+	g_signal_connect(G_OBJECT(w->timer_remove), "clicked",
+			 G_CALLBACK(cb_timer_remove), w);
 	g_signal_connect(G_OBJECT(w->new), "clicked", G_CALLBACK(cb_new), w);
 	g_signal_connect(G_OBJECT(w->summaries), "clicked",
 			 G_CALLBACK(cb_summaries), w);
+	g_signal_connect(G_OBJECT(w->sum_period), "changed",
+			 G_CALLBACK(cb_summaries), w);
+	g_signal_connect(G_OBJECT(w->sum_from), "activate",
+			 G_CALLBACK(cb_summaries), w);
+	g_signal_connect(G_OBJECT(w->sum_to), "activate",
+			 G_CALLBACK(cb_summaries), w);
+	g_signal_connect(G_OBJECT(w->sum_export), "clicked",
+			 G_CALLBACK(cb_sum_export), w);
+	g_signal_connect(G_OBJECT(w->sum_win), "hide",
+			 G_CALLBACK(cb_sum_win_hide), NULL);
+	g_signal_connect(G_OBJECT(w->search), "clicked",
+			 G_CALLBACK(cb_search), w);
+	g_signal_connect(G_OBJECT(w->search_entry), "search-changed",
+			 G_CALLBACK(cb_search_changed), w);
+	g_signal_connect(G_OBJECT(w->search_from), "activate",
+			 G_CALLBACK(cb_search_changed), w);
+	g_signal_connect(G_OBJECT(w->search_to), "activate",
+			 G_CALLBACK(cb_search_changed), w);
+	g_signal_connect(G_OBJECT(w->search_win), "hide",
+			 G_CALLBACK(cb_search_win_hide), NULL);
+	g_signal_connect(G_OBJECT(w->company), "changed",
+			 G_CALLBACK(cb_completion_changed), w);
+	g_signal_connect(G_OBJECT(w->company), "changed",
+			 G_CALLBACK(cb_name_changed), w);
+	g_signal_connect(G_OBJECT(gtk_text_view_get_buffer(
+				GTK_TEXT_VIEW(w->description))), "changed",
+			 G_CALLBACK(cb_desc_changed), w);
+	g_signal_connect(G_OBJECT(w->project), "changed",
+			 G_CALLBACK(cb_name_changed), w);
+	g_signal_connect(G_OBJECT(w->sub_project), "changed",
+			 G_CALLBACK(cb_name_changed), w);
+	g_signal_connect(G_OBJECT(w->project), "changed",
+			 G_CALLBACK(cb_completion_changed), w);
+	g_signal_connect(G_OBJECT(w->sub_project), "changed",
+			 G_CALLBACK(cb_completion_changed), w);
+	g_signal_connect(G_OBJECT(w->list_view), "row-activated",
+			 G_CALLBACK(cb_edit), w);
+	g_signal_connect(G_OBJECT(w->list_view), "query-tooltip",
+			 G_CALLBACK(cb_query_tooltip), w);
 }
 
 int main(int argc, char **argv)
@@ -774,14 +2073,42 @@ int main(int argc, char **argv)
 	GtkBuilder *builder;
 	GError *error = NULL;
 	struct widgets *widgets;
+	bool stats = false;
+	char *reply;
+	char **status;
 	int optind;
+	int ctl_fd;
+	int day;
 	int err;
 
-	while ((optind = getopt(argc, argv, "ah")) != -1) {
+	/* Sub-commands run without ever touching GTK */
+	if (argc > 1 && cli_is_command(argv[1])) {
+		snprintf(tempi_store, sizeof(tempi_store),
+			 TEMPI_DIR "/tempus.sqlite", getenv("HOME"));
+		exit(cli_main(tempi_store, argc - 1, argv + 1));
+	}
+
+	while ((optind = getopt_long(argc, argv, "af:t:sh", long_opts,
+				     NULL)) != -1) {
 		switch (optind) {
 		case 'a':
 			show_all = true;
 			break;
+		case 's':
+			stats = true;
+			break;
+		case 'f':
+		case 't':
+			day = date_to_day(optarg);
+			if (day == DATE_NONE) {
+				disp_usage();
+				exit(EXIT_FAILURE);
+			}
+			if (optind == 'f')
+				from_day = day;
+			else
+				to_day = day;
+			break;
 		case 'h':
 		default:
 			disp_usage();
@@ -793,14 +2120,38 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	stats_init(stats);
+	startup_start = stats_begin();
+
 	err = set_tempi_store();
+	if (err)
+		exit(EXIT_FAILURE);
+	snprintf(journal_file, sizeof(journal_file), JOURNAL_FILE,
+		 getenv("HOME"));
+	snprintf(snapshot_file, sizeof(snapshot_file), SNAPSHOT_FILE,
+		 getenv("HOME"));
+
+	ctl_fd = ctl_connect_start();
+	if (ctl_fd == -1) {
+		fprintf(stderr, "Cannot connect to tempusd\n");
+		exit(EXIT_FAILURE);
+	}
+	/* Once it answers, it's brought the database up to date */
+	if (ctl_request("status\n", &reply) == -1)
+		exit(EXIT_FAILURE);
+	status = ctl_split(reply);
+	g_free(reply);
+
+	err = db_open(tempi_store, true);
 	if (err)
 		exit(EXIT_FAILURE);
 
+	set_history_window();
+
 	gtk_init(&argc, &argv);
 
 	builder = gtk_builder_new();
-	if (!gtk_builder_add_from_file(builder, "tempus.glade", &error)) {
+	if (!gtk_builder_add_from_resource(builder, UI_RESOURCE, &error)) {
 		g_warning("%s", error->message);
 		exit(EXIT_FAILURE);
 	}
@@ -810,15 +2161,39 @@ int main(int argc, char **argv)
 	gtk_builder_connect_signals(builder, widgets);
 	g_object_unref(G_OBJECT(builder));
 
-	tempi = g_tree_new_full((GCompareDataFunc)int_cmp, NULL, NULL,
-				free_lw);
 	load_tempi(widgets);
 
+	if (stats_enabled())
+		g_unix_signal_add(SIGUSR1, cb_stats_report, NULL);
+
+	timers = g_ptr_array_new_with_free_func(free_named_timer);
+	stopwatch_set_tick(cb_tick, widgets);
 	update_window_title(widgets);
+	ctl = ctl_conn_new(ctl_fd, cb_ctl_event, widgets);
+	if (status[0] && status[1] && strcmp(status[1], "idle") != 0)
+		apply_status(widgets, status + 1, true);
+	else
+		restore_recording(widgets);
+	g_strfreev(status);
+	/* Keep up with the recording (& entries saved) from now on */
+	ctl_send("watch", NULL, cb_watching, widgets);
 	gtk_widget_show(widgets->window);
 	gtk_main();
 
+	/* Anything typed that tempusd is yet to be sent */
+	if (edit_timeout_id)
+		send_edit(widgets, false, cb_status_reply);
+	ctl_conn_free(ctl);
+
+	if (default_window)
+		db_submit(save_snapshot_work, NULL, NULL);
+
+	db_close();
+	completion_free(completion);
+	g_ptr_array_free(timers, true);
 	g_slice_free(struct widgets, widgets);
 
+	stats_report(stderr);
+
 	exit(EXIT_SUCCESS);
 }
@@ -14,12 +14,13 @@
 
 struct widgets {
 	GtkWidget *window;
-	GtkWidget *list_box;
+	GtkWidget *list_view;
 	GtkWidget *start;
 	GtkWidget *stop;
 	GtkWidget *save;
 	GtkWidget *new;
 	GtkWidget *summaries;
+	GtkWidget *search;
 	GtkWidget *hours;
 	GtkWidget *minutes;
 	GtkWidget *seconds;
@@ -29,37 +30,54 @@ struct widgets {
 	GtkWidget *description;
 	GtkWidget *dialog;
 
+	GtkWidget *timers_view;
+	GtkWidget *add_timer;
+	GtkWidget *timer_toggle;
+	GtkWidget *timer_save;
+	GtkWidget *timer_remove;
+	GtkListStore *timers_ls;
+
 	GtkListStore *companies;
 	GtkListStore *projects;
 	GtkListStore *sub_projects;
 
+	GtkListStore *tempi_ls;
+
 	GtkWidget *sum_win;
+	GtkWidget *sum_progress;
+	GtkWidget *sum_period;
+	GtkWidget *sum_from;
+	GtkWidget *sum_to;
+	GtkWidget *sum_export;
 
 	GtkListStore *summaries_ls;
 	GtkTreeModelSort *summaries_tms;
-};
 
-enum sql_column {
-	SQL_COL_ID = 0,
-	SQL_COL_DATE,
-	SQL_COL_ENTITY,
-	SQL_COL_PROJECT,
-	SQL_COL_SUB_PROJECT,
-	SQL_COL_DURATION,
-	SQL_COL_DESCRIPTION
+	GtkWidget *search_win;
+	GtkWidget *search_entry;
+	GtkWidget *search_from;
+	GtkWidget *search_to;
+	GtkWidget *search_status;
+	GtkListStore *search_ls;
 };
 
-#define SQL_INSERT \
-	"INSERT INTO tempus " \
-	"(date, entity, project, sub_project, duration, description) " \
-	"VALUES (?, ?, ?, ?, ?, ?)"
-
-#define SQL_UPDATE \
-	"UPDATE tempus SET " \
-	"date = ?, entity = ?, project = ?, sub_project = ?, duration = ?, " \
-	"description = ? WHERE id = ?"
+enum tempi_column {
+	TEMPI_COL_ID = 0,
+	TEMPI_COL_DATE_HDR,
+	TEMPI_COL_COMPANY,
+	TEMPI_COL_PROJECT,
+	TEMPI_COL_SUB_PROJECT,
+	TEMPI_COL_DURATION,
+	TEMPI_COL_HAS_DESCRIPTION,
+	TEMPI_COL_EDITABLE,
+	TEMPI_COL_DATE
+};
 
-extern char *secs_to_dur(int seconds, char *buf, size_t len,
-			 const char *format);
+enum timers_column {
+	TIMERS_COL_ID = 0,
+	TIMERS_COL_STATE,
+	TIMERS_COL_NAME,
+	TIMERS_COL_ELAPSED
+};
 
 #endif /* _TEMPUS_H_ */
@@ -0,0 +1,43 @@
+/*
+ * util.c - Miscellaneous helpers shared by the GUI and command line
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "short_types.h"
+#include "util.h"
+#include "date.h"
+
+bool is_valid_date(const char *date)
+{
+	return date_to_day(date) != DATE_NONE;
+}
+
+void seconds_to_hms(int seconds, u32 *h, u32 *m, u32 *s)
+{
+	u32 secs = seconds;
+
+	*s = secs % 60;
+	secs /= 60;
+	*m = secs % 60;
+	*h = secs / 60;
+}
+
+char *secs_to_dur(int seconds, char *buf, size_t len, const char *format)
+{
+	u32 secs;
+	u32 minutes;
+	u32 hours;
+	const char *fmt = format ? format : "%02u:%02u:%02u";
+
+	seconds_to_hms(seconds, &hours, &minutes, &secs);
+	snprintf(buf, len, fmt, hours, minutes, secs);
+
+	return buf;
+}
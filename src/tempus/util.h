@@ -0,0 +1,23 @@
+/*
+ * util.h - Miscellaneous helpers shared by the GUI and command line
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#ifndef _UTIL_H_
+#define _UTIL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "short_types.h"
+
+extern bool is_valid_date(const char *date);
+extern void seconds_to_hms(int seconds, u32 *h, u32 *m, u32 *s);
+extern char *secs_to_dur(int seconds, char *buf, size_t len,
+			 const char *format);
+
+#endif /* _UTIL_H_ */
@@ -0,0 +1,122 @@
+/*
+ * tempusctl.c - Start, stop & switch the recording held by tempusd
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "util.h"
+#include "ctl.h"
+
+struct ctl_cmd {
+	const char *name;
+	const char *usage;
+	int min_args;
+	int max_args;
+};
+
+static const struct ctl_cmd ctl_cmds[] = {
+	{ "start",	"[ENTITY [PROJECT [SUB_PROJECT]]]",	0, 3 },
+	{ "stop",	"",					0, 0 },
+	{ "switch",	"ENTITY [PROJECT [SUB_PROJECT]]",	1, 3 },
+	{ "status",	"",					0, 0 },
+	{ NULL, NULL, 0, 0 }
+};
+
+static void disp_usage(void)
+{
+	const struct ctl_cmd *cmd;
+
+	printf("Usage:\n\n");
+	for (cmd = ctl_cmds; cmd->name; cmd++)
+		printf("  tempusctl %s%s%s\n", cmd->name,
+		       *cmd->usage ? " " : "", cmd->usage);
+	printf("\nControls the recording held by tempusd, as shown in "
+	       "tempus.\n");
+}
+
+/*
+ * Say how the recording stands from the fields after OK, e.g
+ *
+ *	Recording	Acme / Widgets / Testing	00:00:00
+ */
+static void print_state(char **fields)
+{
+	const char *state;
+	char dur[32];
+	int i;
+
+	if (strcmp(fields[0], "idle") == 0) {
+		printf("Not recording\n");
+		return;
+	}
+
+	if (strcmp(fields[0], "running") == 0)
+		state = "Recording";
+	else if (strcmp(fields[0], "stopped") == 0)
+		state = "Stopped (unsaved)";
+	else
+		state = "Saved";
+
+	printf("%s\t", state);
+	for (i = 2; i < 5 && fields[i - 1] && fields[i] && *fields[i]; i++)
+		printf("%s%s", i > 2 ? " / " : "", fields[i]);
+	printf("\t%s\n", secs_to_dur(fields[1] ? atoi(fields[1]) : 0, dur,
+				     sizeof(dur), NULL));
+}
+
+/*
+ * Kept small (it only needs glib) as it's run for every start & stop,
+ * e.g from a key binding, & should be done in a few milliseconds.
+ */
+int main(int argc, char **argv)
+{
+	const struct ctl_cmd *cmd;
+	char *request;
+	char *reply;
+	char **fields;
+	int nr_args = argc - 2;
+	int ret = EXIT_FAILURE;
+
+	for (cmd = ctl_cmds; argc > 1 && cmd->name; cmd++) {
+		if (strcmp(cmd->name, argv[1]) == 0)
+			break;
+	}
+	if (argc < 2 || !cmd->name || nr_args < cmd->min_args ||
+	    nr_args > cmd->max_args) {
+		disp_usage();
+		exit(EXIT_FAILURE);
+	}
+
+	request = ctl_join(cmd->name, (const char * const *)argv + 2);
+	if (ctl_request(request, &reply) == -1)
+		goto out_free;
+
+	fields = ctl_split(reply);
+	g_free(reply);
+
+	if (!fields[0] || strcmp(fields[0], "OK") != 0 || !fields[1]) {
+		fprintf(stderr, "tempusd: %s\n",
+			fields[0] && fields[1] ? fields[1] : "Bad reply");
+		goto out_freev;
+	}
+
+	print_state(fields + 1);
+	ret = EXIT_SUCCESS;
+
+out_freev:
+	g_strfreev(fields);
+out_free:
+	g_free(request);
+
+	exit(ret);
+}
@@ -0,0 +1,1021 @@
+/*
+ * tempusd.c - Daemon holding a recording & the database, controlled over
+ *	       a Unix socket (see ctl.c)
+ *
+ * Copyright (C) 2020		Andrew Clayton <andrew@digital-domain.net>
+ *
+ * Licensed under the GNU General Public License V2
+ * See COPYING
+ */
+
+#define _GNU_SOURCE			/* accept4(2), SOCK_CLOEXEC */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <linux/limits.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "short_types.h"
+#include "db.h"
+#include "date.h"
+#include "stopwatch.h"
+#include "journal.h"
+#include "ctl.h"
+
+/* Formatted with $HOME */
+#define TEMPI_DIR	"%s/.local/share/tempus"
+#define DB_FILE		TEMPI_DIR "/tempus.sqlite"
+#define JOURNAL_FILE	TEMPI_DIR "/tempusd.journal"
+
+/* Don't let a client that isn't reading its replies hold us up */
+#define CLIENT_SEND_TIMEOUT_SECS	1
+
+#define CLIENT_READ_SIZE	4096
+
+/* The most fields in a reply or event, see saved_fields() */
+#define FIELDS_MAX		9
+
+struct client {
+	int fd;
+	guint source;
+	GString *in;		/* Read but not yet handled */
+	bool busy;		/* Waiting on a save before replying */
+	bool watching;		/* Sent events, see req_watch() */
+	bool closed;
+	int ref;
+};
+
+/*
+ * The one recording. Once stopped it's saved & forgotten, unless that
+ * fails, in which case it's kept (stopped) to be saved again or resumed.
+ */
+struct recording {
+	bool active;
+	bool saving;
+	gint64 id;		/* Of the entry it's for, -1 for a new one */
+	int day;		/* Started on */
+	struct stopwatch sw;
+	char *names[JOURNAL_NAME_MAX];
+	char *description;
+};
+
+enum save_kind {
+	SAVE_STOP = 0,
+	SAVE_SWITCH,
+	SAVE_COMMIT,
+	SAVE_ENTRY,
+};
+
+struct save_job {
+	struct client *client;
+	enum save_kind kind;
+	bool held;		/* Of the recording, it's kept until saved */
+
+	gint64 id;
+	int day;
+	char date[DATE_STR_LEN];
+	u32 elapsed;
+	char *names[JOURNAL_NAME_MAX];
+	char *description;
+
+	/* When switching, what's to be recorded next once it's saved */
+	char *next[JOURNAL_NAME_MAX];
+	struct stopwatch next_sw;
+
+	bool inserted;		/* A new entry, rather than an edit */
+	bool ok;
+};
+
+/* A reply's or event's fields, along with the strings made for them */
+struct fields {
+	const char *args[FIELDS_MAX + 1];
+	char secs[16];
+	char id[24];
+	char inserted[2];
+};
+
+struct request {
+	const char *name;
+	int min_args;
+	int max_args;
+	void (*func)(struct client *c, char **args);
+};
+
+static struct recording rec = { .id = -1 };
+static char journal_file[PATH_MAX];
+static GMainLoop *loop;
+static bool quitting;		/* No more requests, the database is closing */
+/* Clients that sent watch */
+static GPtrArray *watchers;
+
+static bool handle_requests(struct client *c);
+
+static void client_unref(struct client *c)
+{
+	if (--c->ref > 0)
+		return;
+
+	g_string_free(c->in, true);
+	g_slice_free(struct client, c);
+}
+
+static void client_close(struct client *c)
+{
+	if (c->watching)
+		g_ptr_array_remove(watchers, c);
+	c->watching = false;
+	if (c->source)
+		g_source_remove(c->source);
+	c->source = 0;
+	close(c->fd);
+	c->closed = true;
+	client_unref(c);
+}
+
+/* Returns -1 if the line couldn't be sent */
+static int send_line(struct client *c, const char *word,
+		     const char * const *args)
+{
+	char *line = ctl_join(word, args);
+	const char *ptr = line;
+	size_t len = strlen(line);
+	int err = 0;
+
+	while (len > 0) {
+		ssize_t bytes = send(c->fd, ptr, len, MSG_NOSIGNAL);
+
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			err = -1;
+			break;
+		}
+		ptr += bytes;
+		len -= bytes;
+	}
+
+	g_free(line);
+
+	return err;
+}
+
+static void reply(struct client *c, const char *word,
+		  const char * const *args)
+{
+	/* It'll find out when it next tries to read */
+	send_line(c, word, args);
+}
+
+static void reply_error(struct client *c, const char *msg)
+{
+	const char *args[] = { msg, NULL };
+
+	reply(c, "ERR", args);
+}
+
+/*
+ * idle, or the state (running or stopped), elapsed seconds, entity,
+ * project, sub_project, entry id & description
+ */
+static void status_fields(struct fields *f)
+{
+	int i;
+
+	if (!rec.active) {
+		f->args[0] = "idle";
+		f->args[1] = NULL;
+		return;
+	}
+
+	snprintf(f->secs, sizeof(f->secs), "%u", stopwatch_elapsed(&rec.sw));
+	snprintf(f->id, sizeof(f->id), "%" G_GINT64_FORMAT, rec.id);
+
+	f->args[0] = stopwatch_is_running(&rec.sw) ? "running" : "stopped";
+	f->args[1] = f->secs;
+	for (i = 0; i < JOURNAL_NAME_MAX; i++)
+		f->args[i + 2] = rec.names[i];
+	f->args[i + 2] = f->id;
+	f->args[i + 3] = rec.description;
+	f->args[i + 4] = NULL;
+}
+
+/*
+ * saved, the seconds, entity, project, sub_project, entry id, date,
+ * whether it was inserted (1) or updated (0) & description
+ */
+static void saved_fields(struct fields *f, const struct save_job *job)
+{
+	int i;
+
+	snprintf(f->secs, sizeof(f->secs), "%u", job->elapsed);
+	snprintf(f->id, sizeof(f->id), "%" G_GINT64_FORMAT, job->id);
+	snprintf(f->inserted, sizeof(f->inserted), "%d", job->inserted);
+
+	f->args[0] = "saved";
+	f->args[1] = f->secs;
+	for (i = 0; i < JOURNAL_NAME_MAX; i++)
+		f->args[i + 2] = job->names[i];
+	f->args[i + 2] = f->id;
+	f->args[i + 3] = job->date;
+	f->args[i + 4] = f->inserted;
+	f->args[i + 5] = job->description;
+	f->args[i + 6] = NULL;
+}
+
+static void reply_status(struct client *c)
+{
+	struct fields f;
+
+	status_fields(&f);
+	reply(c, "OK", f.args);
+}
+
+/*
+ * Tell the watchers (apart from the one whose request it was, it has
+ * its reply) what's happened. One that can't keep up is got rid of,
+ * once we're back in the main loop.
+ */
+static void notify(struct client *except, const char * const *args)
+{
+	guint i = watchers->len;
+
+	while (i-- > 0) {
+		struct client *c = g_ptr_array_index(watchers, i);
+
+		if (c == except || send_line(c, "EV", args) == 0)
+			continue;
+
+		shutdown(c->fd, SHUT_RDWR);
+		c->watching = false;
+		g_ptr_array_remove_index(watchers, i);
+	}
+}
+
+static void notify_status(struct client *except)
+{
+	struct fields f;
+
+	status_fields(&f);
+	notify(except, f.args);
+}
+
+/* Snapshot the recording to the journal, it's kept up to date from there */
+static void journal_recording(void)
+{
+	struct journal_state state = {
+		.id = rec.id,
+		.day = rec.day,
+		.elapsed = stopwatch_elapsed(&rec.sw),
+		.running = stopwatch_is_running(&rec.sw),
+	};
+	int i;
+
+	for (i = 0; i < JOURNAL_NAME_MAX; i++)
+		state.names[i] = rec.names[i];
+	state.description = g_string_new(rec.description);
+
+	journal_open(journal_file, &state);
+
+	g_string_free(state.description, true);
+}
+
+static void clear_names(char **names)
+{
+	int i;
+
+	for (i = 0; i < JOURNAL_NAME_MAX; i++) {
+		g_free(names[i]);
+		names[i] = NULL;
+	}
+}
+
+/* Up to JOURNAL_NAME_MAX names from args, the rest are empty */
+static void copy_names(char **names, char **args)
+{
+	int i;
+
+	for (i = 0; i < JOURNAL_NAME_MAX; i++) {
+		names[i] = g_strdup(args && *args ? *args : "");
+		if (args && *args)
+			args++;
+	}
+}
+
+/* Start recording afresh, under up to JOURNAL_NAME_MAX names */
+static void new_recording(char **args)
+{
+	clear_names(rec.names);
+	copy_names(rec.names, args);
+	g_free(rec.description);
+	rec.description = g_strdup("");
+
+	rec.active = true;
+	rec.id = -1;
+	rec.day = date_today();
+	stopwatch_stop(&rec.sw);
+	stopwatch_set(&rec.sw, 0);
+	stopwatch_start(&rec.sw);
+
+	journal_recording();
+}
+
+static void clear_recording(void)
+{
+	journal_close(true);
+	clear_names(rec.names);
+	g_free(rec.description);
+	rec.description = NULL;
+	stopwatch_stop(&rec.sw);
+	stopwatch_set(&rec.sw, 0);
+	rec.id = -1;
+	rec.active = false;
+}
+
+/*
+ * Parse the entry id & seconds of an edit or commit, an empty secs
+ * (when allowed) leaves *secs alone.
+ *
+ * Returns false if either isn't a number.
+ */
+static bool parse_entry(char **args, bool secs_needed, gint64 *id, u32 *secs)
+{
+	char *end;
+
+	*id = g_ascii_strtoll(args[0], &end, 10);
+	if (!*args[0] || *end || *id < -1)
+		return false;
+
+	if (!*args[1])
+		return !secs_needed;
+
+	*secs = strtoul(args[1], &end, 10);
+
+	return *args[1] != '-' && !*end;
+}
+
+/*
+ * Journal how the description changed, as the text deleted from & then
+ * inserted at the first char that differs.
+ */
+static void journal_description(const char *old, const char *new)
+{
+	const char *o = old;
+	const char *n = new;
+	const char *o_end = old + strlen(old);
+	const char *n_end = new + strlen(new);
+	long offset;
+
+	while (o < o_end && n < n_end) {
+		const char *o_next = g_utf8_next_char(o);
+		const char *n_next = g_utf8_next_char(n);
+
+		if (o_next - o != n_next - n || memcmp(o, n, o_next - o) != 0)
+			break;
+		o = o_next;
+		n = n_next;
+	}
+	while (o_end > o && n_end > n) {
+		const char *o_prev = g_utf8_prev_char(o_end);
+		const char *n_prev = g_utf8_prev_char(n_end);
+
+		if (o_end - o_prev != n_end - n_prev ||
+		    memcmp(o_prev, n_prev, o_end - o_prev) != 0)
+			break;
+		o_end = o_prev;
+		n_end = n_prev;
+	}
+
+	offset = g_utf8_pointer_to_offset(old, o);
+	if (o_end > o)
+		journal_delete(offset, g_utf8_pointer_to_offset(o, o_end));
+	if (n_end > n)
+		journal_insert(offset, n, n_end - n);
+}
+
+/*
+ * Take on the id, seconds, names & description of an edit or commit.
+ *
+ * These come in as the entry form is typed in, so only what changed is
+ * appended to the journal, which is then synced every so often. A new
+ * recording or entry id gets a fresh journal.
+ */
+static void update_recording(gint64 id, u32 secs, char **args)
+{
+	bool snapshot = !rec.active || id != rec.id || !journal_is_open() ||
+			!g_utf8_validate(args[5], -1, NULL);
+	bool secs_changed = secs != stopwatch_elapsed(&rec.sw);
+	int i;
+
+	if (!rec.active) {
+		rec.active = true;
+		rec.day = date_today();
+	}
+
+	rec.id = id;
+	stopwatch_set(&rec.sw, secs);
+	if (!snapshot && secs_changed && stopwatch_is_running(&rec.sw))
+		journal_start(secs);
+	else if (!snapshot && secs_changed)
+		journal_stop(secs);
+	for (i = 0; i < JOURNAL_NAME_MAX; i++) {
+		if (!snapshot && strcmp(rec.names[i], args[i + 2]) != 0)
+			journal_set_name(i, args[i + 2]);
+		g_free(rec.names[i]);
+		rec.names[i] = g_strdup(args[i + 2]);
+	}
+	if (!snapshot)
+		journal_description(rec.description, args[5]);
+	g_free(rec.description);
+	rec.description = g_strdup(args[5]);
+
+	if (snapshot)
+		journal_recording();
+}
+
+static void save_work(void *data)
+{
+	struct save_job *job = data;
+
+	date_from_day(job->day, job->date, sizeof(job->date));
+	job->inserted = job->id == -1;
+	job->ok = db_save_entry(&job->id, job->date,
+				job->names[JOURNAL_ENTITY],
+				job->names[JOURNAL_PROJECT],
+				job->names[JOURNAL_SUB_PROJECT], job->elapsed,
+				job->description) == 0;
+}
+
+static gboolean save_done(gpointer data)
+{
+	struct save_job *job = data;
+	struct client *c = job->client;
+	struct fields f;
+	int i;
+
+	if (job->held) {
+		rec.saving = false;
+		if (job->ok)
+			clear_recording();
+	}
+
+	if (job->kind == SAVE_SWITCH && job->ok) {
+		for (i = 0; i < JOURNAL_NAME_MAX; i++) {
+			rec.names[i] = job->next[i];
+			job->next[i] = NULL;
+		}
+		rec.description = g_strdup("");
+		rec.active = true;
+		rec.day = date_today();
+		rec.sw = job->next_sw;
+		journal_recording();
+	} else if (job->kind == SAVE_SWITCH) {
+		/* Carry on with the one that's still journaled */
+		stopwatch_stop(&job->next_sw);
+		clear_names(job->next);
+	}
+
+	if (job->ok) {
+		saved_fields(&f, job);
+		notify(c, f.args);
+	}
+	if (job->held)
+		notify_status(c);
+
+	if (!c->closed) {
+		if (!job->ok)
+			reply_error(c, job->kind == SAVE_SWITCH ?
+				    "Cannot save the recording, not switched" :
+				    "Cannot save the recording");
+		else if (job->kind == SAVE_SWITCH)
+			reply_status(c);
+		else
+			reply(c, "OK", f.args);
+
+		c->busy = false;
+		if (!handle_requests(c))
+			client_close(c);
+	}
+	client_unref(c);
+
+	clear_names(job->names);
+	g_free(job->description);
+	g_slice_free(struct save_job, job);
+
+	return G_SOURCE_REMOVE;
+}
+
+static struct save_job *new_save_job(struct client *c, enum save_kind kind)
+{
+	struct save_job *job = g_slice_new0(struct save_job);
+
+	job->client = c;
+	job->kind = kind;
+
+	return job;
+}
+
+/* Replies to c once it's been saved */
+static void submit_save(struct save_job *job)
+{
+	struct client *c = job->client;
+
+	c->ref++;
+	c->busy = true;
+	db_submit(save_work, save_done, job);
+}
+
+/*
+ * Save the (stopped) recording, replying to c once it's done. It stays
+ * journaled until then, so if it can't be saved it's kept.
+ *
+ * When switching, next takes its place once it's saved, but is timed
+ * from now. If the save fails there's no switch, nothing is lost.
+ */
+static void save_recording(struct client *c, char **next)
+{
+	struct save_job *job = new_save_job(c, next ? SAVE_SWITCH : SAVE_STOP);
+	int i;
+
+	for (i = 0; i < JOURNAL_NAME_MAX; i++)
+		job->names[i] = g_strdup(rec.names[i]);
+	job->description = g_strdup(rec.description);
+	job->id = rec.id;
+	job->day = rec.day;
+	job->elapsed = stopwatch_elapsed(&rec.sw);
+	job->held = true;
+	if (next) {
+		copy_names(job->next, next);
+		stopwatch_start(&job->next_sw);
+	}
+
+	rec.saving = true;
+	submit_save(job);
+}
+
+static void req_start(struct client *c, char **args)
+{
+	if (rec.saving) {
+		reply_error(c, "Still saving the last recording");
+		return;
+	}
+
+	if (!rec.active) {
+		new_recording(args);
+	} else if (stopwatch_is_running(&rec.sw)) {
+		reply_error(c, "Already recording");
+		return;
+	} else if (*args) {
+		reply_error(c, "Unsaved recording, stop it to save it");
+		return;
+	} else {
+		stopwatch_start(&rec.sw);
+		journal_start(stopwatch_elapsed(&rec.sw));
+	}
+
+	reply_status(c);
+	notify_status(c);
+}
+
+static void req_stop(struct client *c, char **args __attribute__((unused)))
+{
+	if (!rec.active) {
+		reply_error(c, "Not recording");
+		return;
+	}
+	if (rec.saving) {
+		reply_error(c, "Still saving the last recording");
+		return;
+	}
+
+	stopwatch_stop(&rec.sw);
+	journal_stop(stopwatch_elapsed(&rec.sw));
+	save_recording(c, NULL);
+}
+
+/* Save the current recording, if any, & start a new one */
+static void req_switch(struct client *c, char **args)
+{
+	if (rec.saving) {
+		reply_error(c, "Still saving the last recording");
+		return;
+	}
+
+	if (!rec.active) {
+		new_recording(args);
+		reply_status(c);
+		notify_status(c);
+		return;
+	}
+
+	stopwatch_stop(&rec.sw);
+	journal_stop(stopwatch_elapsed(&rec.sw));
+	save_recording(c, args);
+}
+
+static void req_status(struct client *c, char **args __attribute__((unused)))
+{
+	reply_status(c);
+}
+
+/* From now on, c is sent an event for every change */
+static void req_watch(struct client *c, char **args __attribute__((unused)))
+{
+	if (!c->watching)
+		g_ptr_array_add(watchers, c);
+	c->watching = true;
+
+	reply_status(c);
+}
+
+/*
+ * Set the recording's entry id, seconds (unless empty), names &
+ * description, starting a stopped one if there isn't one.
+ */
+static void req_edit(struct client *c, char **args)
+{
+	gint64 id;
+	u32 secs = stopwatch_elapsed(&rec.sw);
+
+	if (rec.saving) {
+		reply_error(c, "Still saving the last recording");
+		return;
+	}
+	if (!parse_entry(args, false, &id, &secs)) {
+		reply_error(c, "Bad entry id or seconds");
+		return;
+	}
+
+	update_recording(id, secs, args);
+
+	reply_status(c);
+	notify_status(c);
+}
+
+static void req_pause(struct client *c, char **args __attribute__((unused)))
+{
+	if (!rec.active) {
+		reply_error(c, "Not recording");
+		return;
+	}
+
+	if (stopwatch_is_running(&rec.sw)) {
+		stopwatch_stop(&rec.sw);
+		journal_stop(stopwatch_elapsed(&rec.sw));
+		notify_status(c);
+	}
+
+	reply_status(c);
+}
+
+/*
+ * Save an entry for today, with an id of -1 for a new one. If there's
+ * a (stopped) recording, it's what's being saved & goes once it is.
+ */
+static void req_commit(struct client *c, char **args)
+{
+	struct save_job *job;
+	gint64 id;
+	u32 secs;
+
+	if (rec.saving) {
+		reply_error(c, "Still saving the last recording");
+		return;
+	}
+	if (rec.active && stopwatch_is_running(&rec.sw)) {
+		reply_error(c, "Still recording, stop it first");
+		return;
+	}
+	if (!parse_entry(args, true, &id, &secs)) {
+		reply_error(c, "Bad entry id or seconds");
+		return;
+	}
+
+	job = new_save_job(c, SAVE_COMMIT);
+	job->id = id;
+	job->day = date_today();
+	job->elapsed = secs;
+	copy_names(job->names, args + 2);
+	job->description = g_strdup(args[5]);
+
+	/* Kept with what it was saved as, should it fail */
+	if (rec.active) {
+		update_recording(id, secs, args);
+		job->held = true;
+		rec.saving = true;
+	}
+
+	submit_save(job);
+}
+
+/* A new entry for today, of seconds for entity, project & sub_project */
+static void req_save(struct client *c, char **args)
+{
+	struct save_job *job;
+	char *end;
+	u32 secs = strtoul(args[0], &end, 10);
+
+	if (!*args[0] || *args[0] == '-' || *end) {
+		reply_error(c, "Bad seconds");
+		return;
+	}
+
+	job = new_save_job(c, SAVE_ENTRY);
+	job->id = -1;
+	job->day = date_today();
+	job->elapsed = secs;
+	copy_names(job->names, args + 1);
+	job->description = g_strdup("");
+
+	submit_save(job);
+}
+
+static void req_discard(struct client *c, char **args __attribute__((unused)))
+{
+	if (rec.saving) {
+		reply_error(c, "Still saving the last recording");
+		return;
+	}
+
+	if (rec.active) {
+		clear_recording();
+		notify_status(c);
+	}
+
+	reply_status(c);
+}
+
+/* tempusctl uses the first four, tempus the rest */
+static const struct request requests[] = {
+	{ "status",	0, 0,			req_status },
+	{ "start",	0, JOURNAL_NAME_MAX,	req_start },
+	{ "stop",	0, 0,			req_stop },
+	{ "switch",	1, JOURNAL_NAME_MAX,	req_switch },
+	{ "watch",	0, 0,			req_watch },
+	{ "edit",	6, 6,			req_edit },
+	{ "pause",	0, 0,			req_pause },
+	{ "commit",	6, 6,			req_commit },
+	{ "save",	4, 4,			req_save },
+	{ "discard",	0, 0,			req_discard },
+	{ NULL, 0, 0, NULL }
+};
+
+static void handle_request(struct client *c, const char *line)
+{
+	char **fields = ctl_split(line);
+	const struct request *req;
+	int nr_args;
+
+	for (req = requests; req->name; req++) {
+		if (fields[0] && strcmp(fields[0], req->name) == 0)
+			break;
+	}
+
+	nr_args = fields[0] ? (int)g_strv_length(fields + 1) : 0;
+	if (!req->name)
+		reply_error(c, "Unknown request");
+	else if (nr_args < req->min_args || nr_args > req->max_args)
+		reply_error(c, "Wrong number of arguments");
+	else
+		req->func(c, fields + 1);
+
+	g_strfreev(fields);
+}
+
+/*
+ * Handle whatever complete requests have been read, one at a time, as a
+ * reply may have to wait on the database. Once quitting, they're left
+ * unanswered.
+ *
+ * Returns false if the client is to be disconnected.
+ */
+static bool handle_requests(struct client *c)
+{
+	while (!c->busy && !quitting) {
+		char *nl = memchr(c->in->str, '\n', c->in->len);
+		char *line;
+
+		if (!nl) {
+			if (c->in->len < CTL_LINE_MAX)
+				break;
+			reply_error(c, "Request too long");
+			return false;
+		}
+
+		line = g_strndup(c->in->str, nl - c->in->str);
+		g_string_erase(c->in, 0, nl - c->in->str + 1);
+		handle_request(c, line);
+		g_free(line);
+	}
+
+	return true;
+}
+
+static gboolean cb_client(gint fd, GIOCondition condition
+			  __attribute__((unused)), gpointer data)
+{
+	struct client *c = data;
+	char buf[CLIENT_READ_SIZE];
+	ssize_t bytes;
+
+	bytes = read(fd, buf, sizeof(buf));
+	if (bytes == -1 && (errno == EINTR || errno == EAGAIN))
+		return G_SOURCE_CONTINUE;
+
+	if (bytes > 0) {
+		g_string_append_len(c->in, buf, bytes);
+		if (handle_requests(c))
+			return G_SOURCE_CONTINUE;
+	}
+
+	/* Gone, or to be got rid of */
+	c->source = 0;
+	client_close(c);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean cb_accept(gint fd, GIOCondition condition
+			  __attribute__((unused)),
+			  gpointer data __attribute__((unused)))
+{
+	struct timeval tv = { .tv_sec = CLIENT_SEND_TIMEOUT_SECS };
+	struct client *c;
+	int cfd;
+
+	cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+	if (cfd == -1) {
+		if (errno != EINTR && errno != EAGAIN)
+			perror("accept4");
+		return G_SOURCE_CONTINUE;
+	}
+	setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	c = g_slice_new0(struct client);
+	c->fd = cfd;
+	c->in = g_string_new(NULL);
+	c->ref = 1;
+	c->source = g_unix_fd_add(cfd, G_IO_IN | G_IO_HUP | G_IO_ERR,
+				  cb_client, c);
+
+	return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Listen on the control socket, only for our own user. A socket left
+ * behind by a tempusd that didn't get to clean up is replaced, one that
+ * is being listened on means we're already running.
+ */
+static int listen_ctl(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	mode_t old_mask;
+	int fd;
+	int err;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		perror("socket");
+		return -1;
+	}
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		fprintf(stderr, "tempusd is already running\n");
+		goto out_close;
+	}
+	close(fd);
+	unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		perror("socket");
+		return -1;
+	}
+
+	old_mask = umask(0077);
+	err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(old_mask);
+	if (err == -1 || listen(fd, 16) == -1) {
+		fprintf(stderr, "Cannot listen on %s: %s\n", path,
+			strerror(errno));
+		goto out_close;
+	}
+
+	return fd;
+
+out_close:
+	close(fd);
+
+	return -1;
+}
+
+/* Carry on with a recording from before we were stopped */
+static void restore_recording(void)
+{
+	struct journal_state state;
+	int i;
+
+	if (journal_read(journal_file, &state) == 0) {
+		for (i = 0; i < JOURNAL_NAME_MAX; i++) {
+			rec.names[i] = state.names[i];
+			state.names[i] = NULL;
+		}
+		rec.description = g_strdup(state.description->str);
+		rec.id = state.id;
+		rec.day = state.day;
+		rec.active = true;
+		stopwatch_set(&rec.sw, state.elapsed);
+		if (state.running)
+			stopwatch_start(&rec.sw);
+
+		journal_recording();
+	}
+
+	journal_state_clear(&state);
+}
+
+static gboolean cb_quit(gpointer data __attribute__((unused)))
+{
+	quitting = true;
+	g_main_loop_quit(loop);
+
+	return G_SOURCE_REMOVE;
+}
+
+int main(int argc, char **argv __attribute__((unused)))
+{
+	char db_file[PATH_MAX];
+	char *socket_path;
+	int listen_fd;
+	int ret = EXIT_FAILURE;
+
+	if (argc > 1) {
+		printf("Usage: tempusd\n\n");
+		printf("Holds the recording for tempus & tempusctl, which "
+		       "start it if need be.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	snprintf(db_file, sizeof(db_file), DB_FILE, getenv("HOME"));
+	snprintf(journal_file, sizeof(journal_file), JOURNAL_FILE,
+		 getenv("HOME"));
+
+	/* tempus sees to creating it (or converting the old one) */
+	if (access(db_file, F_OK) == -1) {
+		fprintf(stderr, "No database at %s, run tempus once to create "
+			"it\n", db_file);
+		exit(EXIT_FAILURE);
+	}
+
+	socket_path = ctl_socket_path();
+	listen_fd = listen_ctl(socket_path);
+	if (listen_fd == -1)
+		goto out_free;
+
+	if (db_open(db_file, false) != 0)
+		goto out_close;
+
+	restore_recording();
+
+	watchers = g_ptr_array_new();
+	loop = g_main_loop_new(NULL, false);
+	g_unix_fd_add(listen_fd, G_IO_IN, cb_accept, NULL);
+	g_unix_signal_add(SIGINT, cb_quit, NULL);
+	g_unix_signal_add(SIGTERM, cb_quit, NULL);
+	g_main_loop_run(loop);
+
+	/* Finish off any saves, so what they saved isn't journaled again */
+	db_close();
+	while (g_main_context_iteration(NULL, false))
+		;
+
+	/* Keep any recording journaled for next time */
+	journal_close(false);
+	g_main_loop_unref(loop);
+	g_ptr_array_free(watchers, true);
+	ret = EXIT_SUCCESS;
+
+out_close:
+	close(listen_fd);
+	unlink(socket_path);
+out_free:
+	g_free(socket_path);
+
+	exit(ret);
+}
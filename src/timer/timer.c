@@ -17,8 +17,11 @@
 #include <gtk/gtk.h>
 
 #include "short_types.h"
+#include "stopwatch.h"
 
 #define APP_NAME	"Tempus - timer"
+/* Compiled in from timer.glade, see timer.gresource.xml */
+#define UI_RESOURCE	"/net/digital-domain/timer/timer.glade"
 
 struct widgets {
 	GtkWidget *window;
@@ -32,11 +35,11 @@ struct widgets {
 enum timer_states { TIMER_STOPPED = 0, TIMER_RUNNING };
 
 static int timer_state = TIMER_STOPPED;
-static u32 elapsed_seconds;
+static struct stopwatch stopwatch;
 
 static void seconds_to_hms(u32 *hours, u32 *minutes, u32 *seconds)
 {
-	u32 secs = elapsed_seconds;
+	u32 secs = stopwatch_elapsed(&stopwatch);
 
 	*seconds = secs % 60;
 	secs /= 60;
@@ -62,19 +65,13 @@ static void update_window_title(struct widgets *w)
 	gtk_window_set_title(GTK_WINDOW(w->window), title);
 }
 
-static gboolean do_timer(struct widgets *w)
+static void update_timer_display(void *data)
 {
+	struct widgets *w = data;
 	u32 hours;
 	u32 minutes;
 	u32 seconds;
 
-	if (timer_state == TIMER_STOPPED) {
-		update_window_title(w);
-		return false;
-	}
-
-	elapsed_seconds++;
-
 	seconds_to_hms(&hours, &minutes, &seconds);
 
 	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->seconds), seconds);
@@ -82,8 +79,17 @@ static gboolean do_timer(struct widgets *w)
 	gtk_spin_button_set_value(GTK_SPIN_BUTTON(w->hours), hours);
 
 	update_window_title(w);
+}
+
+static gboolean cb_window_state(GtkWidget *window __attribute__((unused)),
+				GdkEventWindowState *event,
+				gpointer data __attribute__((unused)))
+{
+	stopwatch_set_visible(!(event->new_window_state &
+				(GDK_WINDOW_STATE_ICONIFIED |
+				 GDK_WINDOW_STATE_WITHDRAWN)));
 
-	return true;
+	return false;
 }
 
 static void cb_stop_timer(GtkButton *button __attribute__((unused)),
@@ -97,6 +103,8 @@ static void cb_stop_timer(GtkButton *button __attribute__((unused)),
 	gtk_editable_set_editable(GTK_EDITABLE(w->seconds), true);
 
 	timer_state = TIMER_STOPPED;
+	stopwatch_stop(&stopwatch);
+	update_timer_display(w);
 }
 
 static void cb_start_timer(GtkButton *button __attribute__((unused)),
@@ -110,13 +118,13 @@ static void cb_start_timer(GtkButton *button __attribute__((unused)),
 	gtk_editable_set_editable(GTK_EDITABLE(w->seconds), false);
 
 	/* Take into account a possibly adjusted value */
-	elapsed_seconds =
+	stopwatch_set(&stopwatch,
 		gtk_spin_button_get_value(GTK_SPIN_BUTTON(w->hours)) * 3600 +
 		gtk_spin_button_get_value(GTK_SPIN_BUTTON(w->minutes)) * 60 +
-		gtk_spin_button_get_value(GTK_SPIN_BUTTON(w->seconds));
+		gtk_spin_button_get_value(GTK_SPIN_BUTTON(w->seconds)));
 
 	timer_state = TIMER_RUNNING;
-	g_timeout_add(1000, (GSourceFunc)do_timer, w);
+	stopwatch_start(&stopwatch);
 }
 
 static void get_widgets(struct widgets *widgets, GtkBuilder *builder)
@@ -131,6 +139,8 @@ static void get_widgets(struct widgets *widgets, GtkBuilder *builder)
 	widgets->start = GTK_WIDGET(gtk_builder_get_object(builder, "start"));
 	widgets->stop = GTK_WIDGET(gtk_builder_get_object(builder, "stop"));
 
+	g_signal_connect(G_OBJECT(widgets->window), "window-state-event",
+			 G_CALLBACK(cb_window_state), NULL);
 	g_signal_connect(G_OBJECT(widgets->start), "clicked", G_CALLBACK(
 				cb_start_timer), widgets);
 	g_signal_connect(G_OBJECT(widgets->stop), "clicked", G_CALLBACK(
@@ -146,7 +156,7 @@ int main(int argc, char **argv)
 	gtk_init(&argc, &argv);
 
 	builder = gtk_builder_new();
-	if (!gtk_builder_add_from_file(builder, "timer.glade", &error)) {
+	if (!gtk_builder_add_from_resource(builder, UI_RESOURCE, &error)) {
 		g_warning("%s", error->message);
 		exit(EXIT_FAILURE);
 	}
@@ -156,6 +166,7 @@ int main(int argc, char **argv)
 	gtk_builder_connect_signals(builder, widgets);
 	g_object_unref(G_OBJECT(builder));
 
+	stopwatch_set_tick(update_timer_display, widgets);
 	update_window_title(widgets);
 	gtk_widget_set_sensitive(widgets->stop, false);
 	gtk_widget_show(widgets->window);